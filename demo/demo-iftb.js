@@ -55,12 +55,8 @@ function update_sample_toggle() {
 }
 
 function update_fonts(text, font_id, font_face) {
-    let cps = new Set();
-    for (let i = 0; text.codePointAt(i); i++) {
-        cps.add(text.codePointAt(i));
-    }
-
-    return patch_codepoints(font_id, font_face, cps);
+    // The text is passed through whole; the client decodes it
+    return patch_codepoints(font_id, font_face, text);
 }
 
 function patch_codepoints(font_id, font_face, cps) {
@@ -69,6 +65,8 @@ function patch_codepoints(font_id, font_face, cps) {
     let do_init = false;
     if (!states[font_id]) {
       states[font_id] = new iftb_font(false, true);
+      // Pages share most of their text, so only new codepoints are looked up
+      states[font_id].set_incremental(true);
       do_init = true;      
     }
 
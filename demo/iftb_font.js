@@ -10,6 +10,7 @@ it.
 import Module from './iftb.js'
 
 const iftb = await Module()
+const utf8_encoder = new TextEncoder()
 
 export class iftb_font {
     constructor(ranges = false, verbose = false) {
@@ -46,29 +47,81 @@ export class iftb_font {
         return true;
     }
 
+    // codepoints is a Set of codepoints or a string of text
     chunks_for_augmentation(codepoints, features) {
+        if (typeof codepoints === 'string')
+            return this.chunks_for_text(codepoints, features);
         let cnum = codepoints.size;
         let cptr = iftb._iftb_reserve_unicode_list(this.cl, cnum);
         if (cnum > 0) {
             let carr = Uint32Array.from(codepoints.values());
             iftb.HEAPU32.set(carr, cptr/4);
         }
-        let fnum = features.size;
-        let fptr = iftb._iftb_reserve_feature_list(this.cl, fnum);
-        if (fnum > 0) {
-            let farr = Uint32Array.from(features.values());
-            iftb.HEAPU32.set(farr, fptr/4);
-        }
+        let fnum = this.reserve_features(features);
         if (cnum > 0 || fnum > 0) {
             if (!iftb._iftb_compute_pending(this.cl)) {
                 console.log('Problem computing pending chunks');
                 return [];
             }
         }
-        cnum = iftb._iftb_get_pending_list_count(this.cl);
-        cptr = iftb._iftb_get_pending_list_location(this.cl);
+        return this.pending_chunk_list();
+    }
+
+    /* The text is encoded as UTF-8 straight into the WASM heap, so no
+       codepoint set or array is built for it.
+     */
+    chunks_for_text(text, features) {
+        let tlen = text.length * 3;
+        let tptr = iftb._iftb_reserve_text(this.cl, tlen);
+        let fnum = this.reserve_features(features);
+        if (tlen > 0 || fnum > 0) {
+            let r = utf8_encoder.encodeInto(text,
+                                iftb.HEAPU8.subarray(tptr, tptr + tlen));
+            if (!iftb._iftb_compute_pending_text(this.cl, r.written, 0)) {
+                console.log('Problem computing pending chunks');
+                return [];
+            }
+        }
+        return this.pending_chunk_list();
+    }
+
+    /* With incremental pending on, each augmentation only looks up the
+       codepoints and features not seen by an earlier one, and returns
+       only the chunks they add.
+     */
+    set_incremental(on) {
+        iftb._iftb_set_incremental_pending(this.cl, on ? 1 : 0);
+    }
+
+    // Forgets what earlier augmentations asked for and what is pending
+    reset_seen() {
+        iftb._iftb_reset_seen(this.cl);
+    }
+
+    seen_codepoint_count() {
+        return iftb._iftb_get_seen_codepoint_count(this.cl);
+    }
+
+    reserve_features(features) {
+        let fnum = features.size;
+        let fptr = iftb._iftb_reserve_feature_list(this.cl, fnum);
+        if (fnum > 0) {
+            let farr = Uint32Array.from(features.values());
+            iftb.HEAPU32.set(farr, fptr/4);
+        }
+        return fnum;
+    }
+
+    pending_chunk_list() {
+        let cnum = iftb._iftb_get_pending_list_count(this.cl);
+        let cptr = iftb._iftb_get_pending_list_location(this.cl);
         if (this.verbose)
             console.log("Additional chunk count is " + cnum);
+        if (cnum > 0) {
+            let flen = iftb._iftb_reserve_pending_merge(this.cl);
+            if (this.verbose && flen > 0)
+                console.log("Reserved " + flen + " bytes for merged font");
+        }
         return Array.from(iftb.HEAPU16.subarray(cptr/2, cptr/2+cnum))
     }
 
@@ -110,11 +163,15 @@ export class iftb_font {
     }
 
     merge(for_cache) {
+        let heap = iftb.HEAPU8.length;
         let ok = !!iftb._iftb_merge(this.cl, for_cache);
         if (!ok) {
             console.log('Could not merge chunks');
             return false;
         }
+        if (this.verbose && iftb.HEAPU8.length != heap)
+            console.log('WASM heap grew from ' + heap + ' to ' +
+                        iftb.HEAPU8.length + ' bytes during merge');
         return true;
     }
 
@@ -123,23 +180,60 @@ export class iftb_font {
         return await response.arrayBuffer();
     }
 
-    async chunks_from_files(chunklist) {
-        let promiselist = [];
-        for (const cidx of chunklist) {
-            let cs = this.get_chunk_file_uri(cidx);
-            if (cs === '') {
-                console.log('Cannot get chunk ' + cidx);
-                continue;
+    /* Fetches a chunk file and decodes each block of the response body
+     * as it arrives, so that fetching, decompression and (for other
+     * chunks) merging preparation overlap.
+     */
+    async stream_chunk_file(cidx) {
+        let cs = this.get_chunk_file_uri(cidx);
+        if (cs === '') {
+            console.log('Cannot get chunk ' + cidx);
+            return false;
+        }
+        let response = await fetch(new URL(cs, this.orig_url));
+        if (!response.ok || response.body === null) {
+            console.log('Problem fetching chunk ' + cidx);
+            return false;
+        }
+        let r = iftb._iftb_begin_chunk(this.cl, cidx, 0);
+        if (r == 0) {
+            console.log('Problem beginning chunk ' + cidx);
+            return false;
+        } else if (r == 2) {
+            if (this.verbose)
+                console.log('Not adding redundant chunk ' + cidx);
+            await response.body.cancel();
+            return true;
+        }
+        let reader = response.body.getReader();
+        let total = 0;
+        while (true) {
+            const { done, value } = await reader.read();
+            if (done)
+                break;
+            let dptr = iftb._iftb_reserve_stream_data(this.cl,
+                                                      value.byteLength);
+            iftb.HEAPU8.set(value, dptr);
+            if (!iftb._iftb_use_stream_data(this.cl, cidx, value.byteLength)) {
+                console.log('Problem decoding chunk ' + cidx);
+                await reader.cancel();
+                return false;
             }
-            promiselist.push(this.get_url_data(cs));
+            total += value.byteLength;
         }
-        let datalist = await Promise.all(promiselist);
-        let i = 0;
-        let chunkdata = [];
-        for (const cidx of chunklist) {
-            chunkdata.push([cidx, new Uint8Array(datalist[i++])]);
+        if (!iftb._iftb_end_chunk(this.cl, cidx)) {
+            console.log('Problem finishing chunk ' + cidx);
+            return false;
         }
-        return chunkdata;
+        if (this.verbose)
+            console.log('Added chunk ' + cidx + ', length ' + total);
+        return true;
+    }
+
+    async stream_chunks_from_files(chunklist) {
+        let results = await Promise.all(chunklist.map(
+            (cidx) => this.stream_chunk_file(cidx)));
+        return results.every((ok) => ok);
     }
 
     /* --- ranges ---
@@ -390,7 +484,10 @@ export class iftb_font {
 
     async augment(codepoints, features) {
         if (this.verbose) {
-            console.log('Codepoints: ' + Array.from(codepoints).join(','));
+            if (typeof codepoints === 'string')
+                console.log('Text length: ' + codepoints.length);
+            else
+                console.log('Codepoints: ' + Array.from(codepoints).join(','));
         }
         let chunklist = this.chunks_for_augmentation(codepoints, features);
         if (chunklist.length == 0) {
@@ -402,15 +499,18 @@ export class iftb_font {
         if (this.verbose)
             console.log('Augmenting iftb_font object ' + this.cl +
                         ' with chunks [' + chunklist.join(', ') + ']');
-        let chunkdata;
-        let force = false;
-        if (this.ranges) {
-            [chunkdata, force] = await this.chunks_from_range_file(chunklist);
-        } else {
-            chunkdata = await this.chunks_from_files(chunklist);
+        if (!this.ranges) {
+            if (!await this.stream_chunks_from_files(chunklist)) {
+                console.log('Failed to retrieve chunks for augmentation');
+                this.reset_seen();
+                return false;
+            }
+            return this.merge(false);
         }
+        let [chunkdata, force] = await this.chunks_from_range_file(chunklist);
         if (chunkdata.length == 0) {
             console.log('Failed to retrieve chunks for augmentation');
+            this.reset_seen();
             return false;
         }
         for (const [cidx, data] of chunkdata) {
@@ -0,0 +1,176 @@
+/*
+Copyright 2023 Adobe
+All Rights Reserved.
+
+NOTICE: Adobe permits you to use, modify, and distribute this file in
+accordance with the terms of the Adobe license agreement accompanying
+it.
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <map>
+#include <set>
+#include <memory>
+#include <stdexcept>
+
+#include "yaml-cpp/yaml.h"
+
+#include "batch.h"
+#include "chunker.h"
+#include "merger.h"
+#include "tag.h"
+
+namespace {
+
+struct batch_entry {
+    std::filesystem::path font, output;
+    iftb::config *conf = nullptr;
+    bool ok = false;
+    double seconds = 0.0;
+    uintmax_t woff2Size = 0, rangeSize = 0;
+    std::string message;
+};
+
+std::filesystem::path resolve(const std::filesystem::path &dir,
+                              const std::string &p) {
+    std::filesystem::path r = p;
+    if (r.is_relative())
+        r = dir / r;
+    return r.lexically_normal();
+}
+
+void runEntry(batch_entry &e) {
+    std::ifstream ifs(e.font, std::ios::binary);
+    if (!ifs)
+        throw std::runtime_error("Could not open font file");
+    std::stringstream ss;
+    ss << ifs.rdbuf();
+    std::string fs = ss.str();
+    ifs.close();
+    uint32_t tg = iftb::decodeBuffer(NULL, 0, fs);
+    if (tg != 0x00010000 && tg != tag("OTTO"))
+        throw std::runtime_error("Unrecognized font file type");
+
+    iftb::config c;
+    c.copySettings(*e.conf);
+    c.setPathPrefix(e.output);
+    iftb::chunker ck(c);
+    if (ck.process(fs) != 0)
+        throw std::runtime_error("Processing failed");
+
+    std::error_code ec;
+    e.woff2Size = std::filesystem::file_size(c.woff2Path(), ec);
+    e.rangeSize = std::filesystem::file_size(c.rangePath(), ec);
+}
+
+}
+
+int iftb::batch(const std::filesystem::path &manifest,
+                const std::string &defaultConfig, iftb::config &conf,
+                uint16_t parallel) {
+    std::filesystem::path dir = manifest.parent_path();
+    std::map<std::filesystem::path, std::unique_ptr<iftb::config>> configs;
+    std::set<std::filesystem::path> outputs;
+    std::vector<batch_entry> entries;
+
+    auto ym = YAML::LoadFile(manifest.string());
+    if (!ym.IsSequence())
+        throw YAML::Exception(ym.Mark(), "Batch manifest must be a sequence");
+    for (int k = 0; k < ym.size(); k++) {
+        auto n = ym[k];
+        batch_entry e;
+        if (!n.IsMap() || !n["font"].IsScalar())
+            throw YAML::Exception(n.Mark(), "Batch entries must have a font path");
+        e.font = resolve(dir, n["font"].Scalar());
+        if (n["output"].IsScalar()) {
+            e.output = resolve(dir, n["output"].Scalar());
+        } else {
+            e.output = e.font;
+            e.output.replace_extension();
+            e.output += "_iftb";
+        }
+        if (!outputs.insert(e.output).second)
+            throw YAML::Exception(n.Mark(), "Batch entries must have distinct output prefixes");
+        std::filesystem::path cp;
+        if (n["config"].IsScalar())
+            cp = resolve(dir, n["config"].Scalar());
+        else
+            cp = defaultConfig;
+        auto i = configs.find(cp);
+        if (i == configs.end()) {
+            auto c = std::make_unique<iftb::config>();
+            c->copySettings(conf);
+            c->load(cp.string(), false);
+            i = configs.emplace(cp, std::move(c)).first;
+        }
+        e.conf = i->second.get();
+        entries.push_back(std::move(e));
+    }
+
+    if (parallel == 0)
+        parallel = 1;
+    if (parallel > entries.size())
+        parallel = entries.size();
+    if (conf.verbosity())
+        std::cerr << "Processing " << entries.size() << " fonts with "
+                  << configs.size() << " configurations, " << parallel
+                  << " at a time" << std::endl;
+
+    std::atomic<size_t> next {0};
+    auto worker = [&]() {
+        size_t j;
+        while ((j = next++) < entries.size()) {
+            auto &e = entries[j];
+            auto start = std::chrono::steady_clock::now();
+            try {
+                runEntry(e);
+                e.ok = true;
+            } catch (const std::exception &ex) {
+                e.message = ex.what();
+            }
+            std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+            e.seconds = d.count();
+        }
+    };
+    std::vector<std::thread> workers;
+    for (uint16_t t = 1; t < parallel; t++)
+        workers.emplace_back(worker);
+    worker();
+    for (auto &t: workers)
+        t.join();
+
+    int failed = 0;
+    double total = 0.0;
+    std::ios_base::fmtflags flags = std::cerr.flags();
+    std::streamsize precision = std::cerr.precision();
+    std::cerr << std::fixed << std::setprecision(2);
+    std::cerr << std::endl << "Batch Summary" << std::endl;
+    std::cerr << std::setw(9) << "seconds" << std::setw(12) << "woff2";
+    std::cerr << std::setw(12) << "rangefile" << "  font" << std::endl;
+    for (auto &e: entries) {
+        total += e.seconds;
+        std::cerr << std::setw(9) << e.seconds;
+        if (e.ok) {
+            std::cerr << std::setw(12) << e.woff2Size;
+            std::cerr << std::setw(12) << e.rangeSize;
+            std::cerr << "  " << e.font.string() << std::endl;
+        } else {
+            failed++;
+            std::cerr << std::setw(24) << "FAILED";
+            std::cerr << "  " << e.font.string() << ": " << e.message;
+            std::cerr << std::endl;
+        }
+    }
+    std::cerr << entries.size() - failed << " of " << entries.size();
+    std::cerr << " fonts processed, " << total << " font-seconds";
+    std::cerr << std::endl;
+    std::cerr.flags(flags);
+    std::cerr.precision(precision);
+    return failed;
+}
@@ -0,0 +1,33 @@
+/*
+Copyright 2023 Adobe
+All Rights Reserved.
+
+NOTICE: Adobe permits you to use, modify, and distribute this file in
+accordance with the terms of the Adobe license agreement accompanying
+it.
+*/
+
+/* Processes the fonts listed in a YAML manifest on a pool of worker
+   threads, loading each distinct configuration file once. It is only
+   included in the encoder.
+ */
+
+#include <filesystem>
+#include <string>
+
+#include "config.h"
+
+#pragma once
+
+namespace iftb {
+    /* Each manifest entry is a map with a "font" path and optional
+       "config" (default defaultConfig) and "output" prefix (default as
+       for "process"). Relative paths are relative to the manifest's
+       directory. At most parallel fonts are processed at once, each
+       with conf.jobs() closure threads. Returns the number of fonts that
+       failed.
+     */
+    int batch(const std::filesystem::path &manifest,
+              const std::string &defaultConfig, iftb::config &conf,
+              uint16_t parallel);
+}
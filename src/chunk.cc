@@ -9,91 +9,225 @@ it.
 
 #include <sstream>
 #include <cstring>
+#include <chrono>
 
 #include <brotli/encode.h>
 
 #include "chunk.h"
+#include "config.h"
 #include "streamhelp.h"
 #include "tag.h"
 
-void iftb::chunk::compile(std::ostream &os, uint16_t idx,
-                          uint32_t *id,
-                          uint32_t table1,
-                          std::vector<iftb::merger::glyphrec> &recs1,
-                          uint32_t table2,
-                          std::vector<iftb::merger::glyphrec> &recs2,
-                          uint32_t offset) {
-    unsigned int length1, length2;
+/* The size of the string is calculated first so that it can be written
+   in one allocation, which chunk::encode then reads directly.
+ */
+std::string iftb::chunk::compile(uint16_t idx, uint32_t *id,
+                        uint32_t table1,
+                        const std::vector<iftb::merger::glyphrec> &recs1,
+                        uint32_t table2,
+                        const std::vector<iftb::merger::glyphrec> &recs2,
+                        iftb::chunk_size *size) {
     bool twotables = (table2 != 0);
-    os.seekp(offset);
-    writeObject(os, tag("IFTC"));
-    writeObject(os, (uint32_t) 0);  // reserved
-    writeObject(os, id[0]);
-    writeObject(os, id[1]);
-    writeObject(os, id[2]);
-    writeObject(os, id[3]);
-    writeObject(os, (uint32_t) idx);
-    uint32_t bloffset = (uint32_t) os.tellp();
-    writeObject(os, (uint32_t) 0);  // length
-    writeObject(os, (uint32_t) gids.size());
-    writeObject(os, (uint8_t) (twotables ? 2 : 1));
-    uint32_t gid = HB_SET_VALUE_INVALID;
-    while (gids.next(gid))
-        writeObject(os, (uint16_t) gid);
-    writeObject(os, table1);
-    uint32_t c_offset = sizeof(uint32_t) * gids.size();
-    if (twotables) {
-        writeObject(os, table2);
-        c_offset *= 2;
+    uint32_t ntables = twotables ? 2 : 1, count = gids.size();
+    uint32_t gid, length1 = 0, length2 = 0;
+
+    gid = HB_SET_VALUE_INVALID;
+    while (gids.next(gid)) {
+        length1 += recs1[gid].length;
+        if (twotables)
+            length2 += recs2[gid].length;
+    }
+    uint32_t data_length = length1 + length2;
+    // Header, glyph count and table count, gids, table tags, offsets
+    uint32_t c_offset = 32 + 5 + 2 * count + 4 * ntables +
+                        4 * (count * ntables + 1);
+    std::string s(c_offset + data_length, 0);
+    spanwriter w(s.data(), s.size());
+    if (size != nullptr) {
+        size->length = s.size();
+        size->tableBytes[0] = length1;
+        size->tableBytes[1] = length2;
     }
-    c_offset += sizeof(uint32_t);  // Last offset encodes length
-    c_offset += os.tellp();
+
+    w.write(tag("IFTC"));
+    w.write((uint32_t) 0);  // reserved
+    w.write(id[0]);
+    w.write(id[1]);
+    w.write(id[2]);
+    w.write(id[3]);
+    w.write((uint32_t) idx);
+    w.write((uint32_t) s.size());
+    w.write(count);
+    w.write((uint8_t) ntables);
+    gid = HB_SET_VALUE_INVALID;
+    while (gids.next(gid))
+        w.write((uint16_t) gid);
+    w.write(table1);
+    if (twotables)
+        w.write(table2);
     gid = HB_SET_VALUE_INVALID;
     while (gids.next(gid)) {
-        writeObject(os, c_offset);
+        w.write(c_offset);
         c_offset += recs1[gid].length;
     }
     if (twotables) {
         gid = HB_SET_VALUE_INVALID;
         while (gids.next(gid)) {
-            writeObject(os, c_offset);
+            w.write(c_offset);
             c_offset += recs2[gid].length;
         }
     }
-    writeObject(os, c_offset);
+    w.write(c_offset);
     gid = HB_SET_VALUE_INVALID;
     while (gids.next(gid))
-        os.write(recs1[gid].offset, recs1[gid].length);
+        w.write(recs1[gid].offset, recs1[gid].length);
     if (twotables) {
         gid = HB_SET_VALUE_INVALID;
         while (gids.next(gid))
-            os.write(recs2[gid].offset, recs2[gid].length);
+            w.write(recs2[gid].offset, recs2[gid].length);
+    }
+    assert(w.full());
+    return s;
+}
+
+const char *iftb::chunk::modeName(BrotliEncoderMode m) {
+    switch (m) {
+        case BROTLI_MODE_GENERIC:
+            return "generic";
+        case BROTLI_MODE_TEXT:
+            return "text";
+        case BROTLI_MODE_FONT:
+            return "font";
     }
-    uint32_t bl = (uint32_t) os.tellp() - offset;
-    os.seekp(bloffset);
-    writeObject(os, bl);
+    return "unknown";
 }
 
-std::string iftb::chunk::encode(std::stringstream &ss) {
+static BrotliEncoderState *dictEncoder(const iftb::brotli_params &bp,
+                                       int lgwin) {
+    BrotliEncoderState *st = BrotliEncoderCreateInstance(NULL, NULL, NULL);
+    if (st == NULL)
+        throw std::runtime_error("Could not create Brotli encoder");
+    BrotliEncoderSetParameter(st, BROTLI_PARAM_QUALITY, bp.quality);
+    BrotliEncoderSetParameter(st, BROTLI_PARAM_LGWIN, lgwin);
+    BrotliEncoderSetParameter(st, BROTLI_PARAM_MODE, bp.mode);
+    return st;
+}
+
+// Compresses length bytes of data with operation op, appending to out
+static void streamCompress(BrotliEncoderState *st,
+                           BrotliEncoderOperation op,
+                           const char *data, size_t length,
+                           std::string &out) {
+    size_t avail_in = length, avail_out = 0, l;
+    const uint8_t *next_in = (const uint8_t *) data;
+    do {
+        if (!BrotliEncoderCompressStream(st, op, &avail_in, &next_in,
+                                         &avail_out, NULL, NULL))
+            throw std::runtime_error("Could not compress chunk");
+        while (BrotliEncoderHasMoreOutput(st)) {
+            const uint8_t *o = BrotliEncoderTakeOutput(st, &l);
+            out.append((const char *) o, l);
+        }
+    } while (avail_in > 0 ||
+             (op == BROTLI_OPERATION_FINISH && !BrotliEncoderIsFinished(st)));
+}
+
+// Returns the stream prefix, leaving st ready to continue after it
+static std::string primeEncoder(BrotliEncoderState *st,
+                                const iftb::encoder_dictionary &dict) {
+    std::string prefix;
+    streamCompress(st, BROTLI_OPERATION_FLUSH, dict.data.data(),
+                   dict.data.size(), prefix);
+    return prefix;
+}
+
+/* Every chunk continues the prefix, which relies on the encoder output
+   for the dictionary depending only on the dictionary and settings. That
+   is checked here, once, rather than for each chunk.
+ */
+void iftb::chunk::prepareDictionary(iftb::encoder_dictionary &dict,
+                                    const iftb::brotli_params &bp) {
+    for (int i = 0; i < 2; i++) {
+        BrotliEncoderState *st = dictEncoder(bp, dict.lgwin);
+        std::string prefix = primeEncoder(st, dict);
+        BrotliEncoderDestroyInstance(st);
+        if (i == 0)
+            dict.prefix = std::move(prefix);
+        else if (prefix != dict.prefix)
+            throw std::runtime_error("Chunk dictionary prefix mismatch");
+    }
+}
+
+/* Brotli 1.0 can neither copy an encoder state nor attach a dictionary
+   to one, so each chunk's encoder compresses the dictionary again (and
+   discards the output) before the chunk data. That costs about as much
+   as compressing the dictionary's length of chunk data.
+ */
+static void dictCompress(const iftb::encoder_dictionary &dict,
+                         const iftb::brotli_params &bp,
+                         const char *data, size_t length, std::string &out) {
+    BrotliEncoderState *st = dictEncoder(bp, dict.lgwin);
+    primeEncoder(st, dict);
+    streamCompress(st, BROTLI_OPERATION_FINISH, data, length, out);
+    BrotliEncoderDestroyInstance(st);
+}
+
+std::string iftb::chunk::encode(const std::string &s,
+                                const iftb::brotli_params &bp,
+                                std::vector<iftb::brotli_trial> *trials,
+                                const iftb::encoder_dictionary *dict) {
     uint32_t l;
 
-    ss.seekg(28);  // length offset
-    
-    readObject(ss, l);
-    std::string s(ss.str());
+    spanreader sis(s.data(), s.size());
+    sis.seek(28);  // length offset
+    readObject(sis, l);
 
     if (s.size() != l)
         throw std::runtime_error("Length discrepancy in uncompressed chunk");
 
-    size_t encoded_size = BrotliEncoderMaxCompressedSize(l - 32);
-    std::string z(32 + encoded_size, 0);
+    std::vector<std::pair<int, BrotliEncoderMode>> settings;
+    settings.emplace_back(dict ? dict->lgwin : bp.lgwin, bp.mode);
+    if (bp.automatic && !dict) {
+        std::vector<int> windows { bp.lgwin };
+        if (bp.lgwin != BROTLI_MAX_WINDOW_BITS)
+            windows.push_back(BROTLI_MAX_WINDOW_BITS);
+        for (auto m: { BROTLI_MODE_FONT, BROTLI_MODE_GENERIC,
+                       BROTLI_MODE_TEXT }) {
+            for (auto w: windows) {
+                if (m != bp.mode || w != bp.lgwin)
+                    settings.emplace_back(w, m);
+            }
+        }
+    }
+    if (trials)
+        trials->clear();
+
+    size_t max_size = BrotliEncoderMaxCompressedSize(l - 32);
+    std::string z, t;
+    for (auto [lgwin, mode]: settings) {
+        size_t encoded_size = max_size;
+        auto start = std::chrono::steady_clock::now();
+        if (dict) {
+            t.assign(32, 0);
+            dictCompress(*dict, bp, s.data() + 32, l - 32, t);
+            encoded_size = t.size() - 32;
+        } else {
+            t.assign(32 + encoded_size, 0);
+            if (!BrotliEncoderCompress(bp.quality, lgwin, mode, l-32,
+                                       (const uint8_t *) s.data() + 32,
+                                       &encoded_size,
+                                       (uint8_t *) t.data() + 32))
+                 throw std::runtime_error("Could not compress chunk");
+        }
+        std::chrono::duration<double, std::milli> d =
+            std::chrono::steady_clock::now() - start;
+        t.resize(32 + encoded_size);
+        if (trials)
+            trials->push_back({ lgwin, mode, t.size(), d.count() });
+        if (z.empty() || t.size() < z.size())
+            std::swap(z, t);
+    }
     memcpy(z.data(), s.data(), 32);
-    if (!BrotliEncoderCompress(BROTLI_MAX_QUALITY, BROTLI_DEFAULT_WINDOW,
-                               BROTLI_MODE_FONT, l-32,
-                               (const uint8_t *) s.data() + 32,
-                               &encoded_size, (uint8_t *) z.data() + 32))
-         throw std::runtime_error("Could not compress chunk");
-    z.resize(32 + encoded_size);
     z[3] = 'Z';
     return z;
 }
@@ -15,6 +15,8 @@ it.
 #include <iostream>
 #include <vector>
 
+#include <brotli/encode.h>
+
 #include "merger.h"
 #include "wrappers.h"
 
@@ -22,8 +24,27 @@ it.
 
 namespace iftb {
     class chunk;
+    struct brotli_params;
+    struct brotli_trial;
+    struct encoder_dictionary;
 }
 
+// The result of one compression of a chunk
+struct iftb::brotli_trial {
+    int lgwin;
+    BrotliEncoderMode mode;
+    size_t size;
+    double msec;
+};
+
+/* Data that chunks are compressed against and the Brotli stream prefix
+   it compresses to with the chunk settings (see chunk_dictionary).
+ */
+struct iftb::encoder_dictionary {
+    std::string data, prefix;
+    int lgwin = BROTLI_DEFAULT_WINDOW;
+};
+
 class iftb::chunk {
  public:
     chunk() {}
@@ -71,15 +92,27 @@ class iftb::chunk {
         return (permissive || group == c.group);
     }
 
-    // Add the string of this chunk to ostream os at offset offset
-    void compile(std::ostream &os, uint16_t idx,
-                 uint32_t *id,
-                 uint32_t table1,
-                 std::vector<iftb::merger::glyphrec> &recs1,
-                 uint32_t table2,
-                 std::vector<iftb::merger::glyphrec> &recs2,
-                 uint32_t offset = 0);
-    static std::string encode(std::stringstream &ss);
+    /* Returns the uncompressed IFTC string of this chunk. If size is not
+       null it is set to the string length and glyph bytes per table.
+     */
+    std::string compile(uint16_t idx, uint32_t *id,
+                        uint32_t table1,
+                        const std::vector<iftb::merger::glyphrec> &recs1,
+                        uint32_t table2,
+                        const std::vector<iftb::merger::glyphrec> &recs2,
+                        iftb::chunk_size *size = nullptr);
+    /* Returns the Brotli-compressed version of the IFTC string s. If trials
+       is not null it is set to the result of each compression attempted,
+       starting with the configured lgwin and mode.
+     */
+    static std::string encode(const std::string &s,
+                              const iftb::brotli_params &bp,
+                              std::vector<iftb::brotli_trial> *trials = nullptr,
+                              const iftb::encoder_dictionary *dict = nullptr);
+    // Sets dict.prefix from dict.data and dict.lgwin
+    static void prepareDictionary(iftb::encoder_dictionary &dict,
+                                  const iftb::brotli_params &bp);
+    static const char *modeName(BrotliEncoderMode m);
  private:
     // Unicode codepoints that map to this chunk
     iftb::wr_set codepoints;
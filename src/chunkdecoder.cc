@@ -0,0 +1,173 @@
+/*
+Copyright 2023 Adobe
+All Rights Reserved.
+
+NOTICE: Adobe permits you to use, modify, and distribute this file in
+accordance with the terms of the Adobe license agreement accompanying
+it.
+*/
+
+#include <iostream>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include "chunkdecoder.h"
+#include "tag.h"
+
+/* A freed block is reused for any request it covers without being more
+   than twice the size, so the ring buffers of similarly sized chunks
+   share memory.
+ */
+void *iftb::decoder_pool::alloc(void *opaque, size_t size) {
+    auto *pool = static_cast<iftb::decoder_pool *>(opaque);
+    size_t rsize = (size + granule - 1) / granule * granule;
+    char *block;
+
+    auto i = pool->available.lower_bound(rsize);
+    if (i != pool->available.end() && i->first <= 2 * rsize) {
+        block = i->second;
+        pool->held -= i->first;
+        pool->available.erase(i);
+    } else {
+        block = (char *) malloc(header + rsize);
+        if (block == nullptr)
+            return nullptr;
+        *(size_t *) block = rsize;
+    }
+    return block + header;
+}
+
+void iftb::decoder_pool::release(void *opaque, void *address) {
+    auto *pool = static_cast<iftb::decoder_pool *>(opaque);
+    if (address == nullptr)
+        return;
+    char *block = (char *) address - header;
+    size_t rsize = *(size_t *) block;
+    pool->available.emplace(rsize, block);
+    pool->held += rsize;
+}
+
+void iftb::decoder_pool::trim() {
+    for (auto &i: available)
+        free(i.second);
+    available.clear();
+    held = 0;
+}
+
+bool iftb::chunk_decoder::error(const char *m) {
+    std::cerr << "Chunk decode error: " << m << std::endl;
+    failed = true;
+    out.clear();
+    pool.destroy(state);
+    state = nullptr;
+    return false;
+}
+
+/* Chunks compressed with a dictionary continue a Brotli stream that
+   starts with the dictionary prefix, so the prefix is decoded first (to
+   pooled scratch memory) and then the chunk data.
+ */
+bool iftb::chunk_decoder::primeDictionary() {
+    char *scratch = (char *) decoder_pool::alloc(&pool, dict->length);
+    if (scratch == nullptr)
+        return error("Could not allocate dictionary scratch space");
+    size_t avail_in = dict->prefix.size(), avail_out = dict->length;
+    const uint8_t *next_in = (const uint8_t *) dict->prefix.data();
+    uint8_t *next_out = (uint8_t *) scratch;
+    auto r = BrotliDecoderDecompressStream(state, &avail_in, &next_in,
+                                           &avail_out, &next_out, NULL);
+    decoder_pool::release(&pool, scratch);
+    if (r != BROTLI_DECODER_RESULT_NEEDS_MORE_INPUT || avail_out != 0)
+        return error("Could not decompress chunk dictionary");
+    return true;
+}
+
+bool iftb::chunk_decoder::start() {
+    uint32_t tg = tag(header), l;
+
+    if (tg == tag("IFTZ"))
+        compressed = true;
+    else if (tg != tag("IFTC"))
+        return error("File type for chunk is not IFTC or IFTZ");
+    spanreader sr(header, sizeof(header));
+    sr.seek(28);  // length offset
+    readObject(sr, l);
+    if (l < sizeof(header))
+        return error("Chunk length shorter than header");
+
+    // A new string so that the capacity is exactly the chunk length
+    std::string t(l, 0);
+    out.swap(t);
+    memcpy(out.data(), header, sizeof(header));
+    out[3] = 'C';
+    outPos = sizeof(header);
+
+    if (compressed) {
+        state = pool.create();
+        if (state == nullptr)
+            return error("Could not create Brotli decoder");
+        if (dict != nullptr && dict->length > 0 && !primeDictionary())
+            return false;
+    }
+    return true;
+}
+
+bool iftb::chunk_decoder::add(const char *buf, size_t length) {
+    if (failed)
+        return false;
+    if (headerBytes < sizeof(header)) {
+        size_t l = std::min(length, sizeof(header) - headerBytes);
+        memcpy(header + headerBytes, buf, l);
+        headerBytes += l;
+        buf += l;
+        length -= l;
+        if (headerBytes < sizeof(header))
+            return true;
+        if (!start())
+            return false;
+    }
+    if (length == 0)
+        return true;
+
+    if (!compressed) {
+        if (length > out.size() - outPos)
+            return error("Wrong length encoded in chunk");
+        memcpy(out.data() + outPos, buf, length);
+        outPos += length;
+        return true;
+    }
+
+    if (state == nullptr)
+        return error("Data after end of compressed chunk");
+    size_t avail_in = length, avail_out = out.size() - outPos;
+    const uint8_t *next_in = (const uint8_t *) buf;
+    uint8_t *next_out = (uint8_t *) out.data() + outPos;
+    result = BrotliDecoderDecompressStream(state, &avail_in, &next_in,
+                                           &avail_out, &next_out, NULL);
+    outPos = out.size() - avail_out;
+    if (result == BROTLI_DECODER_RESULT_ERROR)
+        return error("Could not decompress IFTZ chunk");
+    else if (result == BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT)
+        return error("Wrong length encoded in chunk");
+    else if (result == BROTLI_DECODER_RESULT_SUCCESS) {
+        if (avail_in > 0)
+            return error("Data after end of compressed chunk");
+        // Hand the decoder's memory back for the next chunk
+        pool.destroy(state);
+        state = nullptr;
+    }
+    return true;
+}
+
+bool iftb::chunk_decoder::finish() {
+    if (failed)
+        return false;
+    if (headerBytes < sizeof(header))
+        return error("Chunk shorter than header");
+    if (compressed && result != BROTLI_DECODER_RESULT_SUCCESS)
+        return error("Compressed chunk data truncated");
+    if (outPos != out.size())
+        return error("Wrong length encoded in chunk");
+    return true;
+}
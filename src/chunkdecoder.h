@@ -0,0 +1,91 @@
+/*
+Copyright 2023 Adobe
+All Rights Reserved.
+
+NOTICE: Adobe permits you to use, modify, and distribute this file in
+accordance with the terms of the Adobe license agreement accompanying
+it.
+*/
+
+/* iftb::chunk_decoder decodes an IFTZ (or copies an IFTC) chunk as its
+   bytes arrive, directly into the string that the merger keeps for the
+   chunk. The Brotli decoder states draw their memory from an
+   iftb::decoder_pool so that decoding a series of chunks reuses the same
+   ring buffers and tables. It is included in both the encoder and the
+   client side.
+ */
+
+#include <string>
+#include <map>
+#include <cstdint>
+
+#include <brotli/decode.h>
+
+#include "table_IFTB.h"
+
+#pragma once
+
+namespace iftb {
+    class decoder_pool;
+    class chunk_decoder;
+}
+
+/* Brotli allocations freed by a decoder are kept by size rather than
+   returned to the heap, and handed out again to later decoders.
+ */
+class iftb::decoder_pool {
+ public:
+    decoder_pool() {}
+    decoder_pool(const decoder_pool &) = delete;
+    decoder_pool &operator=(const decoder_pool &) = delete;
+    ~decoder_pool() { trim(); }
+    BrotliDecoderState *create() {
+        return BrotliDecoderCreateInstance(alloc, release, this);
+    }
+    void destroy(BrotliDecoderState *st) {
+        if (st != nullptr)
+            BrotliDecoderDestroyInstance(st);
+    }
+    // Returns the held allocations to the heap
+    void trim();
+    size_t heldBytes() { return held; }
+    static void *alloc(void *opaque, size_t size);
+    static void release(void *opaque, void *address);
+ private:
+    // Allocations are rounded up to a multiple of granule
+    static const size_t granule = 256;
+    // Room before each allocation for its size, keeping malloc alignment
+    static const size_t header = 16;
+    std::multimap<size_t, char *> available;
+    size_t held {0};
+};
+
+class iftb::chunk_decoder {
+ public:
+    chunk_decoder(iftb::decoder_pool &pool, std::string &out,
+                  const iftb::chunk_dictionary *dict = nullptr) :
+        pool(pool), out(out), dict(dict) {}
+    chunk_decoder(const chunk_decoder &) = delete;
+    chunk_decoder &operator=(const chunk_decoder &) = delete;
+    ~chunk_decoder() { pool.destroy(state); }
+    /* Decodes as much of the chunk as the bytes received so far allow.
+       The output string is sized from the chunk header once the first 32
+       bytes have arrived.
+     */
+    bool add(const char *buf, size_t length);
+    // Returns true if the whole chunk has been received and decoded
+    bool finish();
+    bool failure() { return failed; }
+ private:
+    bool start();
+    bool primeDictionary();
+    bool error(const char *m);
+    iftb::decoder_pool &pool;
+    std::string &out;
+    const iftb::chunk_dictionary *dict;
+    BrotliDecoderState *state {nullptr};
+    BrotliDecoderResult result {BROTLI_DECODER_RESULT_NEEDS_MORE_INPUT};
+    char header[32];
+    size_t headerBytes {0}, outPos {0};
+    bool compressed {false}, failed {false};
+};
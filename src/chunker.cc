@@ -14,6 +14,13 @@ it.
 #include <sstream>
 #include <stdexcept>
 #include <random>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <algorithm>
+#include <iomanip>
 
 #include <woff2/encode.h>
 
@@ -113,6 +120,20 @@ void iftb::chunker::make_group_chunks(int group_num, hb_map_t *gid_chunk_map,
         add_chunk(ch, gid_chunk_map);
 }
 
+// Move the gid and its codepoints into the base
+void iftb::chunker::move_gid_to_base(iftb::chunk &ch, uint32_t gid) {
+    assert(ch.gids.has(gid));
+    ch.gids.del(gid);
+    chunks[0].gids.add(gid);
+    auto [start, end] = nominal_revmap.equal_range(gid);
+    for (auto it = start; it != end; ++it) {
+        assert(ch.codepoints.has(it->second));
+        ch.codepoints.del(it->second);
+        chunks[0].codepoints.add(it->second);
+    }
+    ch.size -= gid_size(gid);
+}
+
 iftb::chunk &iftb::chunker::current_chunk(uint32_t &chid) {
     iftb::chunk *r = &chunks[chid];
     while (r->merged_to != -1) {
@@ -147,19 +168,9 @@ void iftb::chunker::process_overlaps(uint32_t gid, uint32_t chid,
     }
 
     if (move) {
-        // Move the gid and its codepoints into the base
         if (conf.verbosity() > 2)
             std::cerr << "Moving gid " << gid << " to chunk 0" << std::endl;
-        assert(ch.gids.has(gid));
-        ch.gids.del(gid);
-        chunks[0].gids.add(gid);
-        auto [start, end] = nominal_revmap.equal_range(gid);
-        for (auto it = start; it != end; ++it) {
-            assert(ch.codepoints.has(it->second));
-            ch.codepoints.del(it->second);
-            chunks[0].codepoints.add(it->second);
-        }
-        ch.size -= gid_size(gid);
+        move_gid_to_base(ch, gid);
     } else {
         for (auto nid: v) {
             auto &chv = current_chunk(nid);
@@ -235,6 +246,389 @@ void iftb::chunker::process_feature_candidates(uint32_t feat,
     gids.del(gid);
 }
 
+/* Sets gids to the glyph closure of the unicodes and features in in.
+   Call sites that pass light use the light closure engine when it is
+   configured and supports the font.
+ */
+void iftb::chunker::closure(iftb::wr_subset_input &in, iftb::wr_set &gids,
+                            bool light) {
+    if (!light || !lclosure) {
+        ccache.closure(proface, in, gids);
+        return;
+    }
+    if (ccache.lookup(in, 1, gids))
+        return;
+    lclosure->closure(in, gids);
+    ccache.store(in, 1, gids);
+}
+
+// Records the current unicode and feature sets of input as a closure job
+void iftb::chunker::add_closure_job(std::vector<closure_job> &jobs,
+                                    uint32_t key) {
+    auto &cj = jobs.emplace_back();
+    cj.key = key;
+    hb_set_set(cj.unicodes.s, input.unicode_set());
+    hb_set_set(cj.features.s, input.set(HB_SUBSET_SETS_LAYOUT_FEATURE_TAG));
+}
+
+/* Calculates the closure of each job, using up to conf.jobs() threads.
+   Each thread has its own copy of input; proface is only read. The
+   results do not depend on the number of threads.
+ */
+void iftb::chunker::run_closure_jobs(std::vector<closure_job> &jobs) {
+    std::atomic<size_t> next {0};
+    size_t nthreads = std::min((size_t) conf.jobs(), jobs.size());
+    if (nthreads == 0)
+        return;
+    std::vector<iftb::wr_subset_input> inputs(nthreads);
+    for (auto &in: inputs)
+        in.copy(input);
+
+    auto worker = [&](iftb::wr_subset_input &in) {
+        size_t j;
+        while ((j = next++) < jobs.size()) {
+            auto &cj = jobs[j];
+            hb_set_set(in.unicode_set(), cj.unicodes.s);
+            hb_set_set(in.set(HB_SUBSET_SETS_LAYOUT_FEATURE_TAG),
+                       cj.features.s);
+            closure(in, cj.gids, true);
+        }
+    };
+
+    if (nthreads == 1) {
+        worker(inputs[0]);
+        return;
+    }
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < nthreads; i++)
+        threads.emplace_back(worker, std::ref(inputs[i]));
+    for (auto &th: threads)
+        th.join();
+}
+
+/* Builds the glyph dependency graph, returning false if the font has
+   closure sources the graph doesn't model or if the graph fails to
+   reach the full closure.
+ */
+bool iftb::chunker::build_glyph_graph() {
+    wr_set vss, us, seeds, reached;
+    uint32_t vs, u, g;
+    unsigned int l;
+
+    if (tables.has(tag("COLR")) || tables.has(tag("MATH"))) {
+        std::cerr << "Warning: COLR and MATH tables are not modeled by the ";
+        std::cerr << "glyph graph, using full closures" << std::endl;
+        return false;
+    }
+    if (is_cff && !is_variable && glyph_graph::cff_has_seac(primaryRecs)) {
+        std::cerr << "Warning: CFF seac accents are not modeled by the ";
+        std::cerr << "glyph graph, using full closures" << std::endl;
+        return false;
+    }
+
+    graph = std::make_unique<glyph_graph>(glyph_count);
+    wr_blob gsubBlob = hb_face_reference_table(subface.f, tag("GSUB"));
+    const char *b = hb_blob_get_data(gsubBlob.b, &l);
+    if (!graph->add_gsub_edges(b, l)) {
+        std::cerr << "Warning: Could not read GSUB for glyph graph, ";
+        std::cerr << "using full closures" << std::endl;
+        graph = nullptr;
+        return false;
+    }
+    if (!is_cff && !graph->add_glyf_edges(primaryRecs)) {
+        std::cerr << "Warning: Could not read glyf for glyph graph, ";
+        std::cerr << "using full closures" << std::endl;
+        graph = nullptr;
+        return false;
+    }
+    graph->finalize();
+
+    hb_face_collect_variation_selectors(subface.f, vss.s);
+    vs = HB_SET_VALUE_INVALID;
+    while (vss.next(vs)) {
+        us.clear();
+        hb_face_collect_variation_unicodes(subface.f, vs, us.s);
+        u = HB_SET_VALUE_INVALID;
+        while (us.next(u)) {
+            if (hb_font_get_variation_glyph(subfont.f, u, vs, &g) &&
+                g != hb_map_get(nominal_map, u))
+                variant_gids.emplace(u, g);
+        }
+    }
+
+    seeds.copy(gid_with_point);
+    for (auto &i: variant_gids)
+        seeds.add(i.second);
+    seeds.add(0);
+    graph->reach(seeds, reached);
+    if (!gid_closure.is_subset(reached)) {
+        std::cerr << "Warning: Glyph graph does not cover the closure, ";
+        std::cerr << "using full closures" << std::endl;
+        graph = nullptr;
+        return false;
+    }
+    if (conf.verbosity() > 1) {
+        std::cerr << "Glyph graph edge count: " << graph->edgeCount();
+        std::cerr << std::endl;
+    }
+    return true;
+}
+
+// Sets seeds to the glyphs directly mapped from the chunk's codepoints
+void iftb::chunker::chunk_seeds(iftb::chunk &ch, iftb::wr_set &seeds) {
+    uint32_t codepoint = HB_SET_VALUE_INVALID;
+    seeds.clear();
+    while (ch.codepoints.next(codepoint)) {
+        seeds.add(hb_map_get(nominal_map, codepoint));
+        auto [start, end] = variant_gids.equal_range(codepoint);
+        for (auto it = start; it != end; ++it)
+            seeds.add(it->second);
+    }
+}
+
+/* The glyph graph version of the second stage. A gid that is reachable
+   without a chunk's codepoints is one not dominated by that chunk, so
+   one dominator tree answers the question for every chunk.
+ */
+void iftb::chunker::graph_second_stage(iftb::wr_set &remaining_gids,
+                                       std::unordered_multimap<uint32_t,
+                                                               uint32_t>
+                                           &candidate_chunks) {
+    std::vector<wr_set> sources(chunks.size());
+    std::vector<uint32_t> owner;
+    wr_set always, moving;
+    uint32_t gid;
+    bool moved = true;
+
+    auto eligible = [&](iftb::chunk &ch) {
+        return ch.group != 0 && ch.merged_to == -1 &&
+               ch.codepoints.size() != 0;
+    };
+
+    always.add(0);
+    while (moved) {
+        moved = false;
+        for (uint32_t idx = 0; idx < chunks.size(); idx++)
+            chunk_seeds(chunks[idx], sources[idx]);
+        graph->dominate(sources, always, owner);
+        for (uint32_t idx = 0; idx < chunks.size(); idx++) {
+            auto &i = chunks[idx];
+            if (!eligible(i))
+                continue;
+            moving.clear();
+            gid = HB_SET_VALUE_INVALID;
+            while (i.gids.next(gid))
+                if (owner[gid] != idx)
+                    moving.add(gid);
+            gid = HB_SET_VALUE_INVALID;
+            while (moving.next(gid)) {
+                if (conf.verbosity() > 2) {
+                    std::cerr << "Second stage: moving gid " << gid;
+                    std::cerr << " to chunk 0" << std::endl;
+                }
+                move_gid_to_base(i, gid);
+                moved = true;
+            }
+        }
+    }
+
+    gid = HB_SET_VALUE_INVALID;
+    while (remaining_gids.next(gid)) {
+        uint32_t idx = owner[gid];
+        if (idx < chunks.size() && eligible(chunks[idx]))
+            candidate_chunks.emplace(gid, idx);
+    }
+}
+
+
+/* Samples the base font glyph data evenly up to the configured size
+   for chunks to be compressed against. The client gets the compressed
+   form of the dictionary from the IFTB table.
+ */
+void iftb::chunker::build_chunk_dictionary(iftb::table_IFTB &tiftb) {
+    uint32_t budget = conf.dictionary_size(), total = 0, stride, n = 0;
+    wr_set &c0g = chunks[0].gids;
+    uint32_t gid = HB_SET_VALUE_INVALID;
+
+    while (c0g.next(gid))
+        total += primaryRecs[gid].length;
+    if (total == 0)
+        return;
+    stride = total > budget ? (total + budget - 1) / budget : 1;
+    gid = HB_SET_VALUE_INVALID;
+    while (c0g.next(gid) && cdict.data.size() < budget) {
+        if (n++ % stride == 0)
+            cdict.data.append(primaryRecs[gid].offset,
+                              primaryRecs[gid].length);
+    }
+    if (cdict.data.size() > budget)
+        cdict.data.resize(budget);
+
+    // The window should reach back through the dictionary from the end
+    // of a typical chunk
+    cdict.lgwin = std::max(conf.brotli().lgwin, BROTLI_MIN_WINDOW_BITS);
+    while (cdict.lgwin < BROTLI_MAX_WINDOW_BITS &&
+           (1u << cdict.lgwin) - 16 < cdict.data.size() +
+                                      conf.target_chunk_size)
+        cdict.lgwin++;
+    chunk::prepareDictionary(cdict, conf.brotli());
+    tiftb.dictionary.length = cdict.data.size();
+    tiftb.dictionary.prefix = cdict.prefix;
+
+    if (conf.brotli().automatic)
+        std::cerr << "Warning: brotli_mode auto is not used with a chunk "
+                  << "dictionary" << std::endl;
+    if (conf.verbosity()) {
+        std::cerr << "Chunk dictionary: " << cdict.data.size();
+        std::cerr << " bytes, " << cdict.prefix.size() << " compressed, ";
+        std::cerr << "lgwin " << cdict.lgwin << std::endl;
+    }
+}
+
+/* Compiles and Brotli-encodes chunks 1 and up on conf.jobs() threads,
+   writing each to its own file. The calling thread appends the encoded
+   chunks to the range file and tiftb's chunkOffsets in index order as they
+   become available.
+ */
+void iftb::chunker::encode_chunks(iftb::table_IFTB &tiftb, uint32_t table1,
+                                  uint32_t table2) {
+    std::vector<std::string> zchunks(chunks.size());
+    std::vector<bool> ready(chunks.size());
+    std::vector<std::vector<brotli_trial>> trials(chunks.size());
+    std::mutex m;
+    std::condition_variable cv;
+    std::exception_ptr error;
+    std::atomic<size_t> next {1};
+
+    // Each worker fills in its own entry, so there is no need to lock
+    if (conf.chunk_sizes()) {
+        tiftb.chunkSizes.assign(chunks.size() - 1, iftb::chunk_size());
+        tiftb.chunkSizeTables = table2 != 0 ? 2 : 1;
+    }
+
+    auto worker = [&]() {
+        size_t j;
+        while ((j = next++) < chunks.size()) {
+            std::string zchunk;
+            try {
+                if (conf.verbosity() > 2) {
+                    std::stringstream msg;
+                    msg << "Compiling and encoding chunk " << j;
+                    msg << " to file " << conf.chunkPath(j) << std::endl;
+                    std::cerr << msg.str();
+                }
+                std::string cs = chunks[j].compile(j, tiftb.id, table1,
+                                                   primaryRecs, table2,
+                                                   secondaryRecs,
+                                                   tiftb.chunkSizes.empty() ? nullptr
+                                                       : &tiftb.chunkSizes[j-1]);
+                zchunk = iftb::chunk::encode(cs, conf.brotli(),
+                                             &trials[j],
+                                             cdict.data.empty() ? nullptr
+                                                                : &cdict);
+                std::ofstream cfile(conf.chunkPath(j),
+                                    std::ios::trunc | std::ios::binary);
+                cfile.write(zchunk.data(), zchunk.size());
+            } catch (...) {
+                std::lock_guard<std::mutex> lk(m);
+                if (!error)
+                    error = std::current_exception();
+                next = chunks.size();
+                cv.notify_all();
+                return;
+            }
+            std::lock_guard<std::mutex> lk(m);
+            zchunks[j] = std::move(zchunk);
+            ready[j] = true;
+            cv.notify_all();
+        }
+    };
+
+    size_t nthreads = std::max((size_t) 1,
+                               std::min((size_t) conf.jobs(), chunks.size()));
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < nthreads; i++)
+        threads.emplace_back(worker);
+
+    std::ofstream rangefile;
+    rangefile.open(conf.rangePath(), std::ios::trunc | std::ios::binary);
+    uint32_t chunkOffset = 0;
+    for (size_t idx = 1; idx < chunks.size(); idx++) {
+        std::string zchunk;
+        {
+            std::unique_lock<std::mutex> lk(m);
+            cv.wait(lk, [&]() { return ready[idx] || error; });
+            if (!ready[idx])
+                break;
+            zchunk = std::move(zchunks[idx]);
+        }
+        rangefile.write(zchunk.data(), zchunk.size());
+        tiftb.chunkOffsets.push_back(chunkOffset);
+        chunkOffset += zchunk.size();
+    }
+    tiftb.chunkOffsets.push_back(chunkOffset);
+    rangefile.close();
+
+    for (auto &th: threads)
+        th.join();
+    if (error)
+        std::rethrow_exception(error);
+    report_encoding(trials);
+}
+
+/* Reports the size and time of each chunk compression. With the auto
+   Brotli mode the setting used is marked and the others follow.
+ */
+void iftb::chunker::report_encoding(
+                    std::vector<std::vector<iftb::brotli_trial>> &trials) {
+    size_t total = 0, first_total = 0;
+    double msec = 0, first_msec = 0;
+    // The times are printed to a tenth of a millisecond, then cerr restored
+    std::ios_base::fmtflags flags = std::cerr.flags();
+    std::streamsize precision = std::cerr.precision();
+    std::cerr << std::fixed << std::setprecision(1);
+
+    if (conf.verbosity() > 1) {
+        std::cerr << std::endl << "---- Chunk Encoding Report ----";
+        std::cerr << std::endl << std::endl;
+    }
+    for (size_t idx = 1; idx < trials.size(); idx++) {
+        auto &ts = trials[idx];
+        if (ts.empty())
+            continue;
+        size_t best = 0;
+        for (size_t i = 0; i < ts.size(); i++) {
+            if (ts[i].size < ts[best].size)
+                best = i;
+            msec += ts[i].msec;
+        }
+        total += ts[best].size;
+        first_total += ts[0].size;
+        first_msec += ts[0].msec;
+        if (conf.verbosity() <= 1)
+            continue;
+        std::cerr << "Chunk " << idx << ":";
+        for (size_t i = 0; i < ts.size(); i++) {
+            std::cerr << (i == best && ts.size() > 1 ? " *" : " ");
+            std::cerr << chunk::modeName(ts[i].mode) << "/" << ts[i].lgwin;
+            std::cerr << " " << ts[i].size << " bytes ";
+            std::cerr << ts[i].msec;
+            std::cerr << " ms" << (i + 1 < ts.size() ? "," : "");
+        }
+        std::cerr << std::endl;
+    }
+    if (conf.verbosity()) {
+        std::cerr << "Encoded chunks: " << total << " bytes in ";
+        std::cerr << msec << " ms";
+        if (conf.brotli().automatic) {
+            std::cerr << " (" << first_total << " bytes in " << first_msec;
+            std::cerr << " ms with the configured mode alone)";
+        }
+        std::cerr << std::endl;
+    }
+    std::cerr.flags(flags);
+    std::cerr.precision(precision);
+}
 
 int iftb::chunker::process(std::string &input_string) {
     using namespace iftb;
@@ -244,8 +638,7 @@ int iftb::chunker::process(std::string &input_string) {
     unsigned flags;
     bool printed, has_BASE;
     hb_set_t *t;
-    hb_subset_plan_t *plan;
-    hb_map_t *map, *gid_chunk_map;
+    hb_map_t *gid_chunk_map;
     iftb::chunk base;
     simpleistream sis;
     simplestream ss;
@@ -258,6 +651,7 @@ int iftb::chunker::process(std::string &input_string) {
     std::unordered_map<uint32_t, std::unordered_multimap<uint32_t, uint32_t>>
         feature_candidate_chunks;
     std::vector<uint32_t> v;
+    std::vector<closure_job> jobs;
 
     inblob.from_string(input_string, true);
     inface.create(inblob);
@@ -336,6 +730,8 @@ int iftb::chunker::process(std::string &input_string) {
 
     subface.f = hb_subset_or_fail(inface.f, input.i);
     subblob.b = hb_face_reference_blob(subface.f);
+    ccache.setPath(conf.closureCachePath());
+    ccache.setFont(subblob);
     subfont.create(subface);
     glyph_count = subface.get_glyph_count();
 
@@ -473,6 +869,15 @@ int iftb::chunker::process(std::string &input_string) {
     */
 
     proface.create_preprocessed(subface);
+    if (conf.light_closures()) {
+        lclosure = std::make_unique<light_closure>();
+        if (!lclosure->init(proface, primaryRecs, is_cff, is_variable)) {
+            std::cerr << "Warning: Font has glyph closure sources the light ";
+            std::cerr << "closure engine doesn't handle, using subset plans";
+            std::cerr << std::endl;
+            lclosure = nullptr;
+        }
+    }
 
     // Re-initialize input
     flags = HB_SUBSET_FLAGS_DEFAULT;
@@ -499,10 +904,10 @@ int iftb::chunker::process(std::string &input_string) {
     hb_set_set(t, all_features.s);
 
     // Get transitive gid substitution closure for all points and features
-    plan = hb_subset_plan_create_or_fail(proface.f, input.i);
-    map = hb_subset_plan_old_to_new_glyph_mapping(plan);
-    hb_map_keys(map, gid_closure.s);
-    hb_subset_plan_destroy(plan);
+    closure(input, gid_closure);
+
+    if (conf.glyph_graph() && build_glyph_graph() && conf.verbosity())
+        std::cerr << "Using glyph dependency graph" << std::endl;
 
     // Determine which features to encode separately
     feat = HB_SET_VALUE_INVALID;
@@ -512,15 +917,15 @@ int iftb::chunker::process(std::string &input_string) {
             continue;
         hb_set_set(t, all_features.s);
         hb_set_del(t, feat);
-        plan = hb_subset_plan_create_or_fail(proface.f, input.i);
-        map = hb_subset_plan_old_to_new_glyph_mapping(plan);
+        add_closure_job(jobs, feat);
+    }
+    run_closure_jobs(jobs);
+    for (auto &cj: jobs) {
+        feat = cj.key;
         // set scratch2 to the set of GIDs missing when the feature
         // is omitted
-        scratch1.clear();
-        hb_map_keys(map, scratch1.s);
-        hb_subset_plan_destroy(plan);
         scratch2.copy(gid_closure);
-        scratch2.subtract(scratch1);
+        scratch2.subtract(cj.gids);
         for (auto &i: feature_gids)
             scratch2.subtract(i.second);
         if (conf.subset_feature(gid_set_size(scratch2))) {
@@ -530,6 +935,7 @@ int iftb::chunker::process(std::string &input_string) {
                                                            std::move(blah)));
         }
     }
+    jobs.clear();
 
     remaining_gids.copy(gid_closure);
     remaining_gids.subtract(gid_with_point);
@@ -562,10 +968,7 @@ int iftb::chunker::process(std::string &input_string) {
     // input now has the font's base unicodes and all features we aren't
     // subsetting separately
 
-    plan = hb_subset_plan_create_or_fail(proface.f, input.i);
-    map = hb_subset_plan_old_to_new_glyph_mapping(plan);
-    hb_map_keys(map, base.gids.s);
-    hb_subset_plan_destroy(plan);
+    closure(input, base.gids);
     remaining_gids.subtract(base.gids);
 
     // Keep notdef in chunk 0
@@ -607,23 +1010,43 @@ int iftb::chunker::process(std::string &input_string) {
     // into the base, or merge chunks together.
     t = input.unicode_set();
     hb_set_set(t, chunks[0].codepoints.s);
-    idx = -1;
-    for (auto &i: chunks) {
-        idx++;
-        hb_set_union(t, i.codepoints.s);
-        plan = hb_subset_plan_create_or_fail(proface.f, input.i);
-        map = hb_subset_plan_old_to_new_glyph_mapping(plan);
-        scratch1.clear();
-        hb_map_keys(map, scratch1.s);
+    if (graph) {
+        /* The closure of the base and a chunk is reached from both, as
+           glyphs such as a ligature whose first component is in the base
+           can depend on the chunk too. Each edge has one source, so that
+           is what the base reaches plus what the chunk reaches. The base
+           gids are subtracted below, leaving glyphs the base reaches but
+           does not hold as overlaps of every chunk.
+         */
+        iftb::wr_set seeds, base_reach;
+        graph->reach(chunks[0].gids, base_reach);
+        for (idx = 1; idx < chunks.size(); idx++) {
+            auto &cj = jobs.emplace_back();
+            cj.key = idx;
+            chunk_seeds(chunks[idx], seeds);
+            graph->reach(seeds, cj.gids);
+            cj.gids._union(base_reach);
+        }
+    } else {
+        idx = -1;
+        for (auto &i: chunks) {
+            idx++;
+            hb_set_union(t, i.codepoints.s);
+            add_closure_job(jobs, idx);
+            hb_set_subtract(t, i.codepoints.s);
+        }
+        run_closure_jobs(jobs);
+    }
+    for (auto &cj: jobs) {
+        scratch1.copy(cj.gids);
         scratch1.subtract(chunks[0].gids);
-        scratch1.subtract(chunks[idx].gids);
+        scratch1.subtract(chunks[cj.key].gids);
         scratch1.intersect(gid_with_point);
         uint32_t gid = HB_SET_VALUE_INVALID;
         while (scratch1.next(gid))
-            chunk_overlap.emplace(gid, idx);
-        hb_subset_plan_destroy(plan);
-        hb_set_subtract(t, i.codepoints.s);
+            chunk_overlap.emplace(gid, cj.key);
     }
+    jobs.clear();
     for (auto &i: chunk_overlap) {
         if (v.size() > 0 && last_gid != i.first) {
             process_overlaps(last_gid, hb_map_get(gid_chunk_map, last_gid), v);
@@ -649,18 +1072,25 @@ int iftb::chunker::process(std::string &input_string) {
     t = input.set(HB_SUBSET_SETS_LAYOUT_FEATURE_TAG);
     hb_set_set(t, all_features.s);
     t = input.unicode_set();
-    idx = -1;
-    for (auto &i: chunks) {
-        idx++;
-        if (i.group == 0 || i.merged_to != -1 || i.codepoints.size() == 0)
-            // Skip the base chunk and merged chunks
-            continue;
-        hb_set_set(t, unicodes_face.s);
-        hb_set_subtract(t, i.codepoints.s);
-        plan = hb_subset_plan_create_or_fail(proface.f, input.i);
-        map = hb_subset_plan_old_to_new_glyph_mapping(plan);
-        scratch1.clear();
-        hb_map_keys(map, scratch1.s);
+    if (graph) {
+        graph_second_stage(remaining_gids, candidate_chunks);
+    } else {
+        idx = -1;
+        for (auto &i: chunks) {
+            idx++;
+            if (i.group == 0 || i.merged_to != -1 || i.codepoints.size() == 0)
+                // Skip the base chunk and merged chunks
+                continue;
+            hb_set_set(t, unicodes_face.s);
+            hb_set_subtract(t, i.codepoints.s);
+            add_closure_job(jobs, idx);
+        }
+        run_closure_jobs(jobs);
+    }
+    for (auto &cj: jobs) {
+        idx = cj.key;
+        auto &i = chunks[idx];
+        scratch1.copy(cj.gids);
         scratch2.copy(scratch1);
         scratch2.intersect(i.gids);
         if (!scratch2.is_empty()) {
@@ -671,26 +1101,13 @@ int iftb::chunker::process(std::string &input_string) {
                     std::cerr << "Second stage: moving gid " << gid;
                     std::cerr << " to chunk 0" << std::endl;
                 }
-                assert(i.gids.has(gid));
-                i.gids.del(gid);
-                chunks[0].gids.add(gid);
-                auto [start, end] = nominal_revmap.equal_range(gid);
-                for (auto it = start; it != end; ++it) {
-                    assert(i.codepoints.has(it->second));
-                    i.codepoints.del(it->second);
-                    chunks[0].codepoints.add(it->second);
-                }
-                i.size -= gid_size(gid);
+                move_gid_to_base(i, gid);
             }
             if (i.codepoints.is_empty())
                 continue;
             hb_set_set(t, unicodes_face.s);
             hb_set_subtract(t, i.codepoints.s);
-            hb_subset_plan_destroy(plan);
-            plan = hb_subset_plan_create_or_fail(proface.f, input.i);
-            map = hb_subset_plan_old_to_new_glyph_mapping(plan);
-            scratch1.clear();
-            hb_map_keys(map, scratch1.s);
+            closure(input, scratch1);
         }
         scratch2.copy(gid_closure);
         scratch2.subtract(scratch1);
@@ -699,8 +1116,8 @@ int iftb::chunker::process(std::string &input_string) {
         while(scratch2.next(gid)) {
             candidate_chunks.emplace(gid, idx);
         }
-        hb_subset_plan_destroy(plan);
     }
+    jobs.clear();
 
     for (auto &i: candidate_chunks) {
         if (v.size() > 0 && last_gid != i.first) {
@@ -755,26 +1172,27 @@ int iftb::chunker::process(std::string &input_string) {
                 hb_set_set(t, unicodes_face.s);
                 hb_set_subtract(t, i.codepoints.s);
             }
-            plan = hb_subset_plan_create_or_fail(proface.f, input.i);
-            map = hb_subset_plan_old_to_new_glyph_mapping(plan);
-            scratch1.clear();
-            hb_map_keys(map, scratch1.s);
+            add_closure_job(jobs, idx);
+        }
+        run_closure_jobs(jobs);
+        for (auto &cj: jobs) {
+            idx = cj.key;
             for (auto &f: feature_gids) {
                 std::unordered_multimap<uint32_t, uint32_t> &fmmap =
                                             feature_candidate_chunks[f.first];
                 if (idx == 0) {
-                    scratch2.copy(scratch1);
+                    scratch2.copy(cj.gids);
                 } else {
                     scratch2.copy(gid_closure);
-                    scratch2.subtract(scratch1);
+                    scratch2.subtract(cj.gids);
                 }
                 scratch2.intersect(f.second);
                 gid = HB_SET_VALUE_INVALID;
                 while (scratch2.next(gid))
                     fmmap.emplace(gid, idx);
             }
-            hb_subset_plan_destroy(plan);
         }
+        jobs.clear();
     }
 
     uint32_t nonfeat_chunkcount = chunks.size();
@@ -823,6 +1241,11 @@ int iftb::chunker::process(std::string &input_string) {
         }
     }
 
+    if (ccache.enabled() && conf.verbosity()) {
+        std::cerr << "Closure cache: " << ccache.hitCount() << " hits, ";
+        std::cerr << ccache.missCount() << " misses" << std::endl;
+    }
+
     // If any gids fall outside of the closure, add them as final chunks
     scratch1.clear();
     scratch1.add_range(0, glyph_count-1);
@@ -894,7 +1317,7 @@ int iftb::chunker::process(std::string &input_string) {
     tiftb.id[3] = dist(rd);
     tiftb.CFFCharStringsOffset = cff_charstrings_offset;
     tiftb.setChunkCount(chunks.size());
-    tiftb.chunkSet[0] = true;
+    tiftb.chunkSet.set(0);
     tiftb.glyphCount = glyph_count;
     for (uint32_t i = 0; i < glyph_count; i++)
         tiftb.gidMap.push_back(hb_map_get(all_gids, i));
@@ -915,6 +1338,35 @@ int iftb::chunker::process(std::string &input_string) {
     if (curr_feat != 0)
         tiftb.featureMap.emplace(curr_feat, std::move(fm));
 
+    /* Runs follow each codepoint's nominal glyph, as the client's cmap
+       lookup does. Codepoints in chunk 0 are left out.
+     */
+    if (conf.codepoint_ranges()) {
+        uint32_t start = 0, end = 0;
+        uint16_t run_idx = 0;
+        codepoint = HB_SET_VALUE_INVALID;
+        while (unicodes_face.next(codepoint)) {
+            gid = hb_map_get(nominal_map, codepoint);
+            uint16_t cidx = hb_map_get(all_gids, gid);
+            if (run_idx != 0 && (cidx != run_idx || codepoint != end + 1)) {
+                tiftb.addCodepointRange(start, end, run_idx);
+                run_idx = 0;
+            }
+            if (cidx == 0)
+                continue;
+            if (run_idx == 0) {
+                start = codepoint;
+                run_idx = cidx;
+            }
+            end = codepoint;
+        }
+        if (run_idx != 0)
+            tiftb.addCodepointRange(start, end, run_idx);
+        if (conf.verbosity() > 0)
+            std::cerr << "Stored " << tiftb.rangeCount << " codepoint ranges"
+                      << std::endl;
+    }
+
     conf.setNumChunks(chunks.size());
 
     uint32_t table1 = T_GLYF, table2 = 0;
@@ -925,35 +1377,26 @@ int iftb::chunker::process(std::string &input_string) {
     else if (is_variable)
         table2 = T_GVAR;
 
-    idx = -1;
-    std::stringstream css;
-    std::vector<uint8_t> encode_buf;
-    std::ofstream rangefile;
-    rangefile.open(conf.rangePath(), std::ios::trunc | std::ios::binary);
-    uint32_t chunkOffset = 0;
-    std::ofstream cfile;
-    for (auto &c: chunks) {
-        idx++;
-        if (idx == 0)
-            continue;
-        if (conf.verbosity() > 2) {
-            std::cerr << "Compiling and encoding chunk " << idx;
-            std::cerr << " to file " << conf.chunkPath(idx) << std::endl;
+    if (conf.dictionary_size() > 0)
+        build_chunk_dictionary(tiftb);
+
+    // The base glyph data is assembled while the chunks are encoded
+    std::exception_ptr chunk_error;
+    std::thread chunk_stage([&]() {
+        try {
+            encode_chunks(tiftb, table1, table2);
+        } catch (...) {
+            chunk_error = std::current_exception();
         }
-        css.str("");
-        css.clear();
-        c.compile(css, idx, tiftb.id, table1, primaryRecs, table2,
-                  secondaryRecs);
-        std::string zchunk = iftb::chunk::encode(css);
-        cfile.open(conf.chunkPath(idx), std::ios::trunc | std::ios::binary);
-        cfile.write(zchunk.data(), zchunk.size());
-        cfile.close();
-        rangefile.write(zchunk.data(), zchunk.size());
-        tiftb.chunkOffsets.push_back(chunkOffset);
-        chunkOffset += zchunk.size();
-    }
-    tiftb.chunkOffsets.push_back(chunkOffset);
-    rangefile.close();
+    });
+    // Joins the chunk stage if assembling the base throws
+    struct stage_joiner {
+        std::thread &t;
+        ~stage_joiner() {
+            if (t.joinable())
+                t.join();
+        }
+    } join_chunk_stage {chunk_stage};
 
     wr_set &c0g = chunks[0].gids;
 
@@ -1045,6 +1488,10 @@ int iftb::chunker::process(std::string &input_string) {
         }
     }
 
+    chunk_stage.join();
+    if (chunk_error)
+        std::rethrow_exception(chunk_error);
+
     tiftb.filesURI = conf.filesURI();
     tiftb.filesURI.push_back(0);
     tiftb.rangeFileURI = conf.rangeFileURI();
@@ -1054,10 +1501,7 @@ int iftb::chunker::process(std::string &input_string) {
     hb_face_builder_set_font_type(fbldr, T_IFTB);
 
     std::vector<uint32_t> tagOrder;
-    css.str("");
-    css.clear();
-    tiftb.compile(css);
-    std::string iftb_str = css.str();
+    std::string iftb_str = tiftb.compile();
     hb_blob_t *iftbblob = hb_blob_create(iftb_str.data(), iftb_str.size(),
                                          HB_MEMORY_MODE_READONLY, NULL, NULL);
     hb_face_builder_add_table(fbldr, T_IFTB, iftbblob);
@@ -1119,7 +1563,6 @@ int iftb::chunker::process(std::string &input_string) {
     hb_blob_t *outblob = hb_face_reference_blob(fbldr);
     unsigned int size;
     const char *data = hb_blob_get_data(outblob, &size);
-    css.clear();
     ss.rdbuf()->pubsetbuf((char *)data, size);
 
     std::ofstream myfile;
@@ -16,6 +16,9 @@ it.
 #include "chunk.h"
 #include "merger.h"
 #include "config.h"
+#include "glyphgraph.h"
+#include "closurecache.h"
+#include "lightclosure.h"
 #include "wrappers.h"
 
 #pragma once
@@ -24,6 +27,7 @@ it.
 
 namespace iftb {
     class chunker;
+    class table_IFTB;
 }
 
 class iftb::chunker {
@@ -52,15 +56,28 @@ class iftb::chunker {
     std::vector<iftb::merger::glyphrec> primaryRecs, secondaryRecs;
 
     std::vector<iftb::chunk> chunks;
+    iftb::encoder_dictionary cdict;
 
     hb_map_t *nominal_map = NULL, *all_codepoints = NULL, *all_gids = NULL;
     std::unordered_multimap<uint32_t, uint32_t> nominal_revmap;
+    // Glyphs mapped from codepoints by cmap format 14 variation sequences
+    std::unordered_multimap<uint32_t, uint32_t> variant_gids;
+    std::unique_ptr<iftb::glyph_graph> graph;
+    iftb::closure_cache ccache;
+    std::unique_ptr<iftb::light_closure> lclosure;
     iftb::wr_set all_features;
     iftb::wr_set tables;
     iftb::wr_set unicodes_face, gid_closure, gid_with_point;
 
     bool is_cff = false, is_variable = false;
 
+    // The inputs to one glyph closure calculation and its result. key
+    // identifies the job to the code consuming the results.
+    struct closure_job {
+        uint32_t key = 0;
+        iftb::wr_set unicodes, features, gids;
+    };
+
     uint32_t gid_size(uint32_t gid);
     uint32_t gid_set_size(const iftb::wr_set&s);
     void add_chunk(iftb::chunk &ch, hb_map_t *gid_chunk_map);
@@ -76,4 +93,19 @@ class iftb::chunker {
                                     std::map<uint32_t, iftb::chunk> &fchunks,
                                     std::vector<uint32_t> &v);
     iftb::chunk &current_chunk(uint32_t &chid);
+    void move_gid_to_base(iftb::chunk &ch, uint32_t gid);
+    bool build_glyph_graph();
+    void chunk_seeds(iftb::chunk &ch, iftb::wr_set &seeds);
+    void graph_second_stage(iftb::wr_set &remaining_gids,
+                            std::unordered_multimap<uint32_t, uint32_t>
+                                &candidate_chunks);
+    void closure(iftb::wr_subset_input &in, iftb::wr_set &gids,
+                 bool light = false);
+    void add_closure_job(std::vector<closure_job> &jobs, uint32_t key);
+    void run_closure_jobs(std::vector<closure_job> &jobs);
+    void build_chunk_dictionary(iftb::table_IFTB &tiftb);
+    void encode_chunks(iftb::table_IFTB &tiftb, uint32_t table1,
+                       uint32_t table2);
+    void report_encoding(std::vector<std::vector<iftb::brotli_trial>>
+                             &trials);
 };
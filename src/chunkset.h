@@ -0,0 +1,148 @@
+/*
+Copyright 2023 Adobe
+All Rights Reserved.
+
+NOTICE: Adobe permits you to use, modify, and distribute this file in
+accordance with the terms of the Adobe license agreement accompanying
+it.
+*/
+
+/* iftb::chunk_set is a set of chunk indexes stored as a bitset packed
+   into 64-bit words, so unions, differences and range tests over
+   thousands of chunks are a few word operations (which compilers
+   vectorize). It is included in both the encoder and the client side.
+ */
+
+#include <vector>
+#include <cassert>
+#include <cstdint>
+
+#include "streamhelp.h"
+
+#pragma once
+
+namespace iftb {
+    class chunk_set;
+}
+
+class iftb::chunk_set {
+ public:
+    class const_iterator {
+     public:
+        const_iterator(const chunk_set *s, uint32_t i) : s(s), i(i) {}
+        uint32_t operator*() const { return i; }
+        const_iterator &operator++() {
+            i = s->next(i + 1);
+            return *this;
+        }
+        bool operator!=(const const_iterator &o) const { return i != o.i; }
+     private:
+        const chunk_set *s;
+        uint32_t i;
+    };
+    chunk_set() {}
+    explicit chunk_set(uint32_t size) { resize(size); }
+    // Indexes at or above size are dropped
+    void resize(uint32_t size) {
+        n = size;
+        words.resize((n + 63) / 64, 0);
+        if (n % 64 != 0)
+            words.back() &= ~0ULL >> (64 - n % 64);
+    }
+    uint32_t size() const { return n; }
+    // Removes every index, keeping the size
+    void reset() {
+        for (auto &w: words)
+            w = 0;
+    }
+    bool test(uint32_t i) const {
+        return i < n && (words[i >> 6] >> (i & 63) & 1);
+    }
+    bool operator[](uint32_t i) const { return test(i); }
+    void set(uint32_t i) {
+        assert(i < n);
+        words[i >> 6] |= 1ULL << (i & 63);
+    }
+    bool any() const {
+        for (auto w: words)
+            if (w != 0)
+                return true;
+        return false;
+    }
+    uint32_t count() const {
+        uint32_t c = 0;
+        for (auto w: words)
+            c += __builtin_popcountll(w);
+        return c;
+    }
+    // Both sets must be the same size
+    chunk_set &operator|=(const chunk_set &o) {
+        assert(o.n == n);
+        for (size_t k = 0; k < words.size(); k++)
+            words[k] |= o.words[k];
+        return *this;
+    }
+    chunk_set &subtract(const chunk_set &o) {
+        assert(o.n == n);
+        for (size_t k = 0; k < words.size(); k++)
+            words[k] &= ~o.words[k];
+        return *this;
+    }
+    bool intersects(const chunk_set &o) const {
+        assert(o.n == n);
+        uint64_t r = 0;
+        for (size_t k = 0; k < words.size(); k++)
+            r |= words[k] & o.words[k];
+        return r != 0;
+    }
+    // True if any index from first through last is in the set
+    bool anyInRange(uint32_t first, uint32_t last) const {
+        if (first > last || first >= n)
+            return false;
+        if (last >= n)
+            last = n - 1;
+        size_t fw = first >> 6, lw = last >> 6;
+        uint64_t fm = ~0ULL << (first & 63), lm = ~0ULL >> (63 - (last & 63));
+        if (fw == lw)
+            return (words[fw] & fm & lm) != 0;
+        if (words[fw] & fm)
+            return true;
+        for (size_t k = fw + 1; k < lw; k++)
+            if (words[k] != 0)
+                return true;
+        return (words[lw] & lm) != 0;
+    }
+    // The smallest index at or after i in the set, or size() if none
+    uint32_t next(uint32_t i) const {
+        if (i >= n)
+            return n;
+        size_t k = i >> 6;
+        uint64_t w = words[k] & (~0ULL << (i & 63));
+        while (w == 0) {
+            if (++k >= words.size())
+                return n;
+            w = words[k];
+        }
+        return k * 64 + __builtin_ctzll(w);
+    }
+    const_iterator begin() const { return const_iterator(this, next(0)); }
+    const_iterator end() const { return const_iterator(this, n); }
+    /* The IFTB table stores the set as (size + 7) / 8 bytes with index i
+       in bit i % 8 of byte i / 8, which is the little-endian byte order of
+       the words.
+     */
+    template<class W>
+    void write(W &o) const {
+        for (uint32_t b = 0; b < (n + 7) / 8; b++)
+            writeObject(o, (uint8_t) (words[b / 8] >> (b % 8 * 8)));
+    }
+    void read(spanreader &is) {
+        reset();
+        for (uint32_t b = 0; b < (n + 7) / 8; b++)
+            words[b / 8] |= (uint64_t) readObject<uint8_t>(is) << (b % 8 * 8);
+        resize(n);
+    }
+ private:
+    std::vector<uint64_t> words;
+    uint32_t n {0};
+};
@@ -7,16 +7,22 @@ accordance with the terms of the Adobe license agreement accompanying
 it.
 */
 
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+
 #include "client.h"
 #include "streamhelp.h"
 #include "tag.h"
 
-bool iftb::client::loadFont(std::string &s, bool keepGIDMap) {
-    return loadFont(s.data(), s.length(), keepGIDMap);
+bool iftb::client::loadFont(std::string &s) {
+    return loadFont(s.data(), s.length());
 }
 
-bool iftb::client::loadFont(char *buf, uint32_t length, bool keepGIDMap) {
-    uint32_t tg = iftb::decodeBuffer(buf, length, fontData, extraPercent());
+bool iftb::client::loadFont(char *buf, uint32_t length) {
+    // Reserved exactly, as merges size their buffer from the final layout
+    uint32_t tg = iftb::decodeBuffer(buf, length, fontData);
     if (tg != 0x00010000 && tg != tag("OTTO") && tg != tag("IFTB"))
         return error("Unrecognized font type.");
 
@@ -26,44 +32,152 @@ bool iftb::client::loadFont(char *buf, uint32_t length, bool keepGIDMap) {
         return false;
     }
 
-    if (!sfnt.getTableStream(ss, T_IFTB))
+    spanreader sr;
+    if (!sfnt.getTableReader(sr, T_IFTB))
         return error("No IFTB table in font");
 
-    if (!tiftb.decompile(ss)) {
+    if (!tiftb.decompile(sr)) {
         failed = true;
         return false;
     }
 
-    if (!sfnt.getTableStream(ss, T_CMAP))
-        return error("No cmap table in font");
+    // With codepoint ranges chunks are looked up in the IFTB table
+    if (!tiftb.hasCodepointRanges()) {
+        if (!sfnt.getTableReader(sr, T_CMAP))
+            return error("No cmap table in font");
 
-    if (!tiftb.addcmap(ss, keepGIDMap)) {
-        failed = true;
-        return false;
+        if (!tiftb.addcmap(sr)) {
+            failed = true;
+            return false;
+        }
     }
     merger.setID(tiftb.getID());
+    pendingChunks.resize(tiftb.getChunkCount());
+    addedChunks.resize(tiftb.getChunkCount());
+    resetSeen();
 
     return true;
 }
 
 bool iftb::client::addChunk(uint16_t idx, char *buf, uint32_t length,
                             bool setPending) {
+    return beginChunk(idx, setPending) && addChunkData(idx, buf, length) &&
+           endChunk(idx);
+}
+
+bool iftb::client::checkAddable(uint16_t idx, bool setPending) {
     if (!hasFont() or failed)
         return false;
     if (idx >= tiftb.getChunkCount())
         return error("Chunk index exceeds chunk count");
     if (setPending) {
-        pendingChunks.insert(idx);
-    } else if (pendingChunks.find(idx) == pendingChunks.end()) {
+        pendingChunks.set(idx);
+    } else if (!pendingChunks.test(idx)) {
         return error("Cannot add chunk index that is not pending");
     }
-    uint32_t tg = iftb::decodeBuffer(buf, length, merger.stringForChunk(idx));
-    if (tg != tag("IFTC"))
-        return error("File type for chunk is not IFTC");
+    // The glyph records of a deferred merge point into the chunk data
+    if (merger.isUnpacked(idx))
+        return error("Cannot replace chunk awaiting a deferred merge");
+    return true;
+}
+
+/* Each worker decodes with its own pool straight into the merger's
+   string for the chunk. The merger unpacks chunks in index order, so the
+   result does not depend on which thread finishes first.
+ */
+bool iftb::client::addChunks(const std::map<uint16_t, std::string> &chunks,
+                             bool setPending, uint16_t jobs) {
+    std::vector<std::pair<uint16_t, const std::string *>> work;
+    const iftb::chunk_dictionary *dict = tiftb.getDictionary();
+
+    for (auto &[idx, s]: chunks) {
+        if (!checkAddable(idx, setPending))
+            return false;
+        if (decoders.find(idx) != decoders.end())
+            return error("Chunk is already being added");
+        work.emplace_back(idx, &s);
+    }
+
+    std::vector<char> ok(work.size(), 0);
+    std::atomic<size_t> next {0};
+    auto worker = [&]() {
+        iftb::decoder_pool pool;
+        size_t j;
+        while ((j = next++) < work.size()) {
+            auto [idx, s] = work[j];
+            iftb::chunk_decoder d(pool, merger.stringForChunk(idx), dict);
+            ok[j] = d.add(s->data(), s->size()) && d.finish();
+        }
+    };
+    if (jobs == 0)
+        jobs = std::max(1u, std::thread::hardware_concurrency());
+    size_t nthreads = std::min((size_t) jobs, work.size());
+    std::vector<std::thread> workers;
+    for (size_t t = 1; t < nthreads; t++)
+        workers.emplace_back(worker);
+    worker();
+    for (auto &t: workers)
+        t.join();
+
+    int failedIdx = -1;
+    for (size_t j = 0; j < work.size(); j++) {
+        if (ok[j]) {
+            noteArrival();
+            continue;
+        }
+        merger.dropChunk(work[j].first);
+        if (failedIdx < 0)
+            failedIdx = work[j].first;
+    }
+    if (failedIdx >= 0) {
+        std::string m = "Could not decode chunk " + std::to_string(failedIdx);
+        return error(m.c_str());
+    }
+    return true;
+}
+
+bool iftb::client::beginChunk(uint16_t idx, bool setPending) {
+    if (!checkAddable(idx, setPending))
+        return false;
+    decoders[idx] = std::make_unique<iftb::chunk_decoder>(decoderPool,
+                                                merger.stringForChunk(idx),
+                                                tiftb.getDictionary());
+    return true;
+}
+
+bool iftb::client::addChunkData(uint16_t idx, const char *buf,
+                                uint32_t length) {
+    auto i = decoders.find(idx);
+    if (i == decoders.end())
+        return error("Chunk data added before the chunk was begun");
+    if (!i->second->add(buf, length)) {
+        decoders.erase(i);
+        merger.dropChunk(idx);
+        return error("Could not decode chunk data");
+    }
+    return true;
+}
+
+bool iftb::client::endChunk(uint16_t idx) {
+    auto i = decoders.find(idx);
+    if (i == decoders.end())
+        return error("Chunk ended before it was begun");
+    bool ok = i->second->finish();
+    decoders.erase(i);
+    if (!ok) {
+        merger.dropChunk(idx);
+        return error("Could not decode chunk");
+    }
+    noteArrival();
     return true;
 }
 
 bool iftb::client::canMerge() {
+    if (!decoders.empty()) {
+        std::cerr << "Can't merge: chunk " << decoders.begin()->first;
+        std::cerr << " is still being added" << std::endl;
+        return false;
+    }
     for (auto i: pendingChunks)
         if (!merger.hasChunk(i)) {
             std::cerr << "Can't merge: missing chunk " << i << std::endl;
@@ -72,46 +186,155 @@ bool iftb::client::canMerge() {
     return true;
 }
 
+bool iftb::client::hasArrived(uint16_t idx) {
+    return merger.hasChunk(idx) && decoders.find(idx) == decoders.end();
+}
+
+void iftb::client::noteArrival() {
+    if (!arrivalsWaiting) {
+        arrivalsWaiting = true;
+        firstArrival = std::chrono::steady_clock::now();
+    }
+}
+
+bool iftb::client::mergeDue() {
+    size_t bytes = 0;
+    bool arrived = false, waiting = false;
+
+    if (!hasFont() or failed)
+        return false;
+    for (auto i: pendingChunks) {
+        if (!hasArrived(i)) {
+            waiting = true;
+            continue;
+        }
+        arrived = true;
+        bytes += merger.chunkBytes(i);
+    }
+    if (!arrived)
+        return false;
+    if (!waiting || (mergeBytes == 0 && mergeMillis == 0))
+        return true;
+    if (mergeBytes > 0 && bytes >= mergeBytes)
+        return true;
+    auto waited = std::chrono::steady_clock::now() - firstArrival;
+    return mergeMillis > 0 &&
+           waited >= std::chrono::milliseconds(mergeMillis);
+}
+
 bool iftb::client::merge(bool asIFTB) {
+    iftb::chunk_set ready;
+
+    if (progressiveMerge) {
+        if (!hasFont() or failed)
+            return false;
+        ready.resize(pendingChunks.size());
+        for (auto i: pendingChunks)
+            if (hasArrived(i))
+                ready.set(i);
+        // Nothing has arrived, so there is nothing to relayout
+        if (!ready.any())
+            return true;
+        if (!merger.unpackChunks(&ready))
+            return false;
+    } else {
+        if (!canMerge())
+            return false;
+        if (!merger.unpackChunks())
+            return false;
+        ready = pendingChunks;
+    }
+
+    tiftb.updateChunkSet(ready);
+    pendingChunks.subtract(ready);
+    arrivalsWaiting = false;
+    // When no chunks are being decoded the pooled memory can go
+    if (decoders.empty())
+        decoderPool.trim();
+    if (deferMerge) {
+        mergeDeferred = true;
+        deferredIFTB = asIFTB;
+        return true;
+    }
+    return mergeGlyphData(asIFTB);
+}
+
+bool iftb::client::mergeGlyphData(bool asIFTB) {
     std::string newString;
     bool swapping = false;
 
     char *newBuf = fontData.data();
-    if (!canMerge())
-        return false;
-
-    if (!merger.unpackChunks())
-        return false;
+    mergeDeferred = false;
 
     uint32_t newLength = merger.calcLayout(sfnt, tiftb.getGlyphCount(),
                                       tiftb.getCharStringOffset());
     if (newLength == 0)
         return false;
+    mstats = merge_stats();
+    mstats.oldLength = fontData.size();
+    mstats.newLength = newLength;
+    mstats.chunkBytes = merger.chunkBytes();
+    /* calcLayout gives the exact merged length. Merge in place when it
+       fits, otherwise directly from the old buffer into one of exactly
+       that length, so at most the old and new fonts are held at once.
+     */
     if (newLength > fontData.capacity()) {
         swapping = true;
-        newString.reserve((uint32_t) ((float)newLength *
-                                      (1 + extraPercent())));
+        newString.reserve(newLength);
         newString.resize(newLength, 0);
         newBuf = newString.data();
+        mstats.peakBufferBytes = fontData.capacity() + newString.capacity();
+        mstats.inPlace = false;
     } else {
         fontData.resize(newLength, 0);
+        mstats.peakBufferBytes = fontData.capacity();
     }
+    // Checksums are updated incrementally from correct previous values
+    bool updateSums = !deferChecksums && !checksumsStale;
     // merge method reassigns sfnt's buffer.
-    if (!merger.merge(sfnt, fontData.data(), newBuf))
+    if (!merger.merge(sfnt, fontData.data(), newBuf, updateSums))
         return false;
-    tiftb.updateChunkSet(pendingChunks);
-    if (!sfnt.getTableStream(ss, T_IFTB))
+    spanreader sr;
+    if (!sfnt.getTableStream(ss, T_IFTB) || !sfnt.getTableReader(sr, T_IFTB))
         return false;
+    uint32_t setSum = tiftb.chunkSetChecksum(sr.data());
     tiftb.writeChunkSet(ss, true);
-    if (!sfnt.recalcTableChecksum(T_IFTB))
+    if (updateSums) {
+        setSum = tiftb.chunkSetChecksum(sr.data()) - setSum;
+        if (!sfnt.adjustChecksum(T_IFTB, setSum))
+            return false;
+    } else if (deferChecksums) {
+        checksumsStale = true;
+    } else if (!sfnt.recalcChecksums()) {
         return false;
+    } else {
+        checksumsStale = false;
+    }
     if (!sfnt.write(asIFTB))
         return false;
     isIFTB = asIFTB;
     if (swapping)
         fontData.swap(newString);
     merger.reset();
-    pendingChunks.clear();
+    return rebindTable();
+}
+
+bool iftb::client::finishChecksums() {
+    if (!flush())
+        return false;
+    if (!checksumsStale)
+        return true;
+    if (!sfnt.recalcChecksums() || !sfnt.write(isIFTB))
+        return false;
+    checksumsStale = false;
+    return true;
+}
+
+bool iftb::client::rebindTable() {
+    spanreader sr;
+    if (!sfnt.getTableReader(sr, T_IFTB))
+        return error("No IFTB table in font");
+    tiftb.rebind(sr.data());
     return true;
 }
 
@@ -125,15 +348,154 @@ bool iftb::client::setPending(const std::vector<uint32_t> &unicodes,
                               const std::vector<uint32_t> &features) {
     if (!hasFont() or failed)
         return false;
-    return tiftb.getMissingChunks(unicodes, features, pendingChunks);
+    resetPendingText();
+    for (auto cp: unicodes)
+        addPendingCodepoint(cp);
+    addPending(features);
+    return true;
+}
+
+bool iftb::client::setPending(const std::vector<uint32_t> &unicodes,
+                              const std::vector<uint32_t> &features,
+                              const std::vector<float> &weights) {
+    if (!hasFont() or failed)
+        return false;
+    resetPendingText();
+    if (incrementalPending && weights.size() == unicodes.size()) {
+        // Repeats within the call keep their weight
+        std::vector<uint32_t> newUnicodes;
+        std::vector<float> newWeights;
+        for (size_t i = 0; i < unicodes.size(); i++) {
+            if (seenCodepoints.test(unicodes[i]))
+                continue;
+            newUnicodes.push_back(unicodes[i]);
+            newWeights.push_back(weights[i]);
+        }
+        for (auto cp: newUnicodes)
+            seenCodepoints.insert(cp);
+        if (!tiftb.rankMissingChunks(newUnicodes, newWeights, features,
+                                     addedChunks, pendingOrder))
+            return false;
+    } else if (!tiftb.rankMissingChunks(unicodes, weights, features,
+                                        addedChunks, pendingOrder)) {
+        return false;
+    }
+    addPending(features);
+    return true;
+}
+
+bool iftb::client::setPendingText(const char *utf8, size_t length,
+                                  const std::vector<uint32_t> &features) {
+    if (!hasFont() or failed)
+        return false;
+    resetPendingText();
+    iftb::decodeUTF8(utf8, length,
+                     [this](uint32_t cp) { addPendingCodepoint(cp); });
+    addPending(features);
+    return true;
+}
+
+bool iftb::client::setPendingText(const uint16_t *utf16, size_t length,
+                                  const std::vector<uint32_t> &features) {
+    if (!hasFont() or failed)
+        return false;
+    resetPendingText();
+    iftb::decodeUTF16(utf16, length,
+                      [this](uint32_t cp) { addPendingCodepoint(cp); });
+    addPending(features);
+    return true;
+}
+
+/* Feature chunks depend on every chunk the font will have, so when a call
+   adds chunks the features seen before are checked again. The feature
+   map is small next to the text, and without new chunks or features
+   nothing is checked at all.
+ */
+void iftb::client::addPending(const std::vector<uint32_t> &features) {
+    bool newFeatures = false;
+    if (!incrementalPending)
+        seenFeatures.clear();
+    for (auto f: features)
+        newFeatures |= seenFeatures.insert(f).second;
+    if (!newFeatures && !addedChunks.any())
+        return;
+    iftb::chunk_set all = pendingChunks;
+    all |= addedChunks;
+    tiftb.addFeatureChunks(std::vector<uint32_t>(seenFeatures.begin(),
+                                                 seenFeatures.end()), all);
+    addedChunks = all;
+    addedChunks.subtract(pendingChunks);
+    pendingChunks = std::move(all);
 }
 
 bool iftb::client::getPendingChunkList(std::vector<uint16_t> &cl) {
     if (!hasFont() or failed)
         return false;
     cl.clear();
-    for (auto i: pendingChunks)
+    // In incremental mode chunks pending from earlier calls are not listed
+    const iftb::chunk_set &from = incrementalPending ? addedChunks
+                                                    : pendingChunks;
+    iftb::chunk_set listed(pendingChunks.size());
+    for (auto i: pendingOrder) {
+        if (!pendingChunks[i] || !from[i])
+            continue;
         cl.push_back(i);
+        listed.set(i);
+    }
+    for (auto i: from)
+        if (pendingChunks[i] && !listed[i])
+            cl.push_back(i);
+    return true;
+}
+
+bool iftb::client::getPendingSizes(uint32_t &fontLength, size_t &chunkBytes) {
+    uint64_t glyphBytes = 0;
+
+    fontLength = 0;
+    chunkBytes = 0;
+    if (!hasFont() or failed)
+        return false;
+    for (auto i: pendingChunks) {
+        const iftb::chunk_size *cs = tiftb.getChunkSize(i);
+        if (cs == nullptr)
+            return false;
+        chunkBytes += cs->length;
+        glyphBytes += cs->tableBytes[0] + cs->tableBytes[1];
+    }
+    // Data already unpacked by a deferred merge has yet to be added
+    if (mergeDeferred)
+        glyphBytes += merger.chunkBytes();
+    // Each of the (at most three) moved tables may gain alignment padding
+    if (glyphBytes > 0)
+        glyphBytes += 12;
+    if (fontData.size() + glyphBytes > UINT32_MAX)
+        return false;
+    fontLength = fontData.size() + glyphBytes;
+    return true;
+}
+
+bool iftb::client::reservePending() {
+    uint32_t fontLength;
+    size_t chunkBytes;
+
+    if (!getPendingSizes(fontLength, chunkBytes))
+        return false;
+    return reserveFontLength(fontLength);
+}
+
+bool iftb::client::reserveFontLength(uint32_t fontLength) {
+    if (!hasFont() or failed)
+        return false;
+    if (fontLength > fontData.capacity()) {
+        // reserve() on a non-empty string may round the capacity up
+        std::string newString;
+        newString.reserve(fontLength);
+        newString.assign(fontData);
+        fontData.swap(newString);
+        // The table directory holds offsets, so only the buffer moves
+        sfnt.setBuffer(fontData);
+        return rebindTable();
+    }
     return true;
 }
 
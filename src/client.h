@@ -15,11 +15,16 @@ it.
 #include <string>
 #include <vector>
 #include <set>
+#include <map>
+#include <memory>
+#include <chrono>
 
 #include "sfnt.h"
 #include "table_IFTB.h"
 #include "tag.h"
 #include "merger.h"
+#include "chunkdecoder.h"
+#include "codepoints.h"
 #include "streamhelp.h"
 #include "randtest.h"
 
@@ -32,16 +37,73 @@ namespace iftb {
 
 class iftb::client {
  public:
+    // Buffer use of the last merge that rebuilt the glyph tables
+    struct merge_stats {
+        uint32_t oldLength = 0, newLength = 0;
+        // Font buffer capacity held at once, and decoded chunk data
+        size_t peakBufferBytes = 0, chunkBytes = 0;
+        bool inPlace = true;
+    };
     friend bool iftb::randtest(std::string &s, uint32_t iterations);
     friend class iftb::wasm_wrapper;
-    bool loadFont(std::string &s, bool keepGIDMap = false);
-    bool loadFont(char *buf, uint32_t length, bool keepGIDMap = false);
+    bool loadFont(std::string &s);
+    bool loadFont(char *buf, uint32_t length);
     bool hasFont() { return fontData.size() > 0; }
     bool failure() { return failed; }
     uint16_t getChunkCount();
     bool setPending(const std::vector<uint32_t> &unicodes,
                     const std::vector<uint32_t> &features);
+    /* As above, with a weight for each codepoint (such as its frequency
+       in the visible text). getPendingChunkList() then lists the most
+       valuable chunks to fetch first (see table_IFTB::rankMissingChunks).
+     */
+    bool setPending(const std::vector<uint32_t> &unicodes,
+                    const std::vector<uint32_t> &features,
+                    const std::vector<float> &weights);
+    /* As setPending, with the codepoints of UTF-8 or UTF-16 text. Each
+       is decoded, deduplicated and mapped to its chunk in a single pass,
+       without building a codepoint list.
+     */
+    bool setPendingText(const char *utf8, size_t length,
+                        const std::vector<uint32_t> &features);
+    bool setPendingText(const uint16_t *utf16, size_t length,
+                        const std::vector<uint32_t> &features);
+    /* In incremental mode the codepoints and features given to each
+       setPending or setPendingText call are remembered rather than
+       replacing the last call's, so a page that asks again with mostly
+       the same text only looks up what is new. Chunks already pending
+       stay pending, and getPendingChunkList() lists just those the last
+       call added. Changing the mode forgets what was seen.
+     */
+    void setIncrementalPending(bool i) {
+        incrementalPending = i;
+        resetSeen();
+    }
+    /* Forgets the seen codepoints and features and the pending chunks, so
+       the next call resolves everything again (for instance after a fetch
+       failed). No chunk should be in progress.
+     */
+    void resetSeen() {
+        seenCodepoints.clear();
+        seenFeatures.clear();
+        pendingChunks.reset();
+        addedChunks.reset();
+        pendingOrder.clear();
+    }
+    const iftb::codepoint_set &getSeenCodepoints() { return seenCodepoints; }
+    const std::set<uint32_t> &getSeenFeatures() { return seenFeatures; }
+    // Chunks made pending since setPending() follow in index order
     bool getPendingChunkList(std::vector<uint16_t> &cl);
+    /* When the IFTB table has chunk sizes, sets fontLength to an upper
+       bound on the font length after merging the pending chunks and
+       chunkBytes to their total uncompressed size, before any are fetched.
+       Returns false if the sizes are not known.
+     */
+    bool getPendingSizes(uint32_t &fontLength, size_t &chunkBytes);
+    // Reserves the font buffer so that merging the pending chunks is in place
+    bool reservePending();
+    // Reserves room for a font of fontLength bytes, for merges in place
+    bool reserveFontLength(uint32_t fontLength);
     std::string &getRangeFileURI() { return tiftb.getRangeFileURI(); }
     uint32_t getChunkOffset(uint16_t cidx);
     std::pair<uint32_t, uint32_t> getChunkRange(uint16_t cidx);
@@ -52,9 +114,57 @@ class iftb::client {
     bool hasChunk(uint16_t idx) { return tiftb.hasChunk(idx); }
     bool addChunk(uint16_t idx, char *buf, uint32_t length,
                   bool setPending = false);
+    /* Decodes a batch of compressed chunks, keyed by index, on up to jobs
+       threads (0 for one per CPU). Each is added as by addChunk(), and
+       the first failure in index order is the one reported.
+     */
+    bool addChunks(const std::map<uint16_t, std::string> &chunks,
+                   bool setPending = false, uint16_t jobs = 0);
+    /* Adds a chunk as its bytes arrive, decoding each block as it is
+       passed in so that no copy of the compressed chunk is needed. Any
+       number of chunks can be in progress at once, but the pending
+       chunks cannot be merged until each has been ended.
+     */
+    bool beginChunk(uint16_t idx, bool setPending = false);
+    bool addChunkData(uint16_t idx, const char *buf, uint32_t length);
+    bool endChunk(uint16_t idx);
     bool canMerge();
     bool merge(bool asIFTB = true);
+    /* With progressive merging, merge() merges the pending chunks that
+       have arrived (been added and ended) rather than failing until all
+       have, adding only those to the chunk set. The rest stay pending.
+     */
+    void setProgressiveMerge(bool p) { progressiveMerge = p; }
+    /* Coalesces progressive merges: mergeDue() is true once the arrived
+       chunks hold at least bytes of decoded data or the first of them
+       arrived millis ago, or when every pending chunk has arrived. A
+       budget of 0 is no limit, and with both 0 any arrival is due.
+     */
+    void setMergeBudget(size_t bytes, uint32_t millis) {
+        mergeBytes = bytes;
+        mergeMillis = millis;
+    }
+    bool mergeDue();
+    /* When merges are deferred, merge() only records the glyph data of
+       the pending chunks and updates the chunk set, so a merge costs about
+       as much as the data added. The glyph tables are rebuilt in one pass
+       when the font is next retrieved, or on an explicit flush(), and
+       until then the font bytes are those before the deferred merges.
+       This only helps native callers that merge several times before
+       using the font; the browser loads the font after every merge, so
+       the WASM build does not offer it.
+     */
+    void setDeferredMerge(bool d) { deferMerge = d; }
+    bool flush() {
+        if (!mergeDeferred)
+            return true;
+        return mergeGlyphData(deferredIFTB);
+    }
     bool setType(bool asIFTB) {
+        if (mergeDeferred) {
+            deferredIFTB = asIFTB;
+            return flush();
+        }
         if (asIFTB != isIFTB) {
             if (!sfnt.write(asIFTB))
                 return false;
@@ -65,19 +175,72 @@ class iftb::client {
     bool isCFF() {
         return !sfnt.has(T_GLYF);
     }
-    std::string &getFontAsString() { return fontData; }
+    /* With deferred checksums merges leave the table checksums and
+       head.checkSumAdjustment stale, saving the passes over the merged
+       tables when the font is only being loaded. They are brought up to
+       date by finishChecksums(), or when the font is retrieved with
+       deferral turned off.
+     */
+    void setDeferredChecksums(bool d) { deferChecksums = d; }
+    bool finishChecksums();
+    std::string &getFontAsString() {
+        if (deferChecksums)
+            flush();
+        else
+            finishChecksums();
+        return fontData;
+    }
+    const merge_stats &lastMergeStats() { return mstats; }
  private:
+    bool mergeGlyphData(bool asIFTB);
+    // The IFTB table is read in place, so it follows the font data
+    bool rebindTable();
+    bool checkAddable(uint16_t idx, bool setPending);
+    bool hasArrived(uint16_t idx);
+    // Starts a call, collecting its chunks in addedChunks
+    void resetPendingText() {
+        addedChunks.reset();
+        pendingOrder.clear();
+        if (!incrementalPending) {
+            pendingChunks.reset();
+            seenCodepoints.clear();
+        }
+    }
+    void addPendingCodepoint(uint32_t cp) {
+        if (seenCodepoints.insert(cp)) {
+            uint16_t ck = tiftb.getMissingChunk(cp);
+            if (ck != 0)
+                addedChunks.set(ck);
+        }
+    }
+    void addPending(const std::vector<uint32_t> &features);
+    void noteArrival();
     bool error(const char *m) {
         std::cerr << "IFTB Client Error: " << m << std::endl;
         failed = true;
         return false;
     }
-    static constexpr float extraPercent() { return 1.0; }
     iftb::table_IFTB tiftb;
     iftb::sfnt sfnt;
-    std::set<uint16_t> pendingChunks;
+    iftb::chunk_set pendingChunks;
+    // The chunks made pending by the last setPending call
+    iftb::chunk_set addedChunks;
+    // Empty unless setPending() was given weights
+    std::vector<uint16_t> pendingOrder;
+    iftb::codepoint_set seenCodepoints;
+    std::set<uint32_t> seenFeatures;
     iftb::merger merger;
+    iftb::decoder_pool decoderPool;
+    std::map<uint16_t, std::unique_ptr<iftb::chunk_decoder>> decoders;
     std::string fontData;
+    merge_stats mstats;
     simplestream ss;
     bool failed {false}, isIFTB = true;
+    bool deferMerge {false}, mergeDeferred {false}, deferredIFTB {true};
+    bool deferChecksums {false}, checksumsStale {false};
+    bool progressiveMerge {false}, arrivalsWaiting {false};
+    bool incrementalPending {false};
+    size_t mergeBytes {0};
+    uint32_t mergeMillis {0};
+    std::chrono::steady_clock::time_point firstArrival;
 };
@@ -0,0 +1,201 @@
+/*
+Copyright 2023 Adobe
+All Rights Reserved.
+
+NOTICE: Adobe permits you to use, modify, and distribute this file in
+accordance with the terms of the Adobe license agreement accompanying
+it.
+*/
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <random>
+#include <cstring>
+#include <cassert>
+
+#include "closurecache.h"
+#include "streamhelp.h"
+#include "tag.h"
+
+// name is FNV-1a, check is an unrelated multiplicative mix so that a
+// collision in one is very unlikely to be a collision in the other
+void iftb::closure_cache::key::add(uint32_t v) {
+    for (int i = 0; i < 4; i++) {
+        name = (name ^ ((v >> (i * 8)) & 0xFF)) * 0x100000001b3;
+    }
+    check = (check ^ v) * 0x9e3779b97f4a7c15;
+    check ^= check >> 29;
+}
+
+void iftb::closure_cache::key::add(const char *data, size_t length) {
+    size_t i;
+    add((uint32_t) length);
+    for (i = 0; i + 4 <= length; i += 4) {
+        uint32_t v;
+        memcpy(&v, data + i, 4);
+        add(v);
+    }
+    for (; i < length; i++)
+        add((uint32_t) (uint8_t) data[i]);
+}
+
+// Sets are hashed as ranges so that large contiguous sets are cheap
+void iftb::closure_cache::key::add(const hb_set_t *s) {
+    hb_codepoint_t first, last = HB_SET_VALUE_INVALID;
+    add(hb_set_get_population(s));
+    while (hb_set_next_range(s, &first, &last)) {
+        add(first);
+        add(last);
+    }
+}
+
+void iftb::closure_cache::setPath(const std::filesystem::path &p) {
+    path = p;
+    if (path.empty())
+        return;
+    std::error_code ec;
+    std::filesystem::create_directories(path, ec);
+    if (ec || !std::filesystem::is_directory(path)) {
+        std::cerr << "Warning: Cannot use closure cache directory " << path;
+        std::cerr << ", not caching closures" << std::endl;
+        path.clear();
+    }
+}
+
+void iftb::closure_cache::setFont(const char *data, size_t length) {
+    const char *v = hb_version_string();
+    fontKey = key();
+    fontKey.add(v, strlen(v));
+    fontKey.add(data, length);
+}
+
+iftb::closure_cache::key
+iftb::closure_cache::makeKey(iftb::wr_subset_input &in, uint32_t engine) {
+    static const hb_subset_sets_t sets[] = {
+        HB_SUBSET_SETS_GLYPH_INDEX, HB_SUBSET_SETS_UNICODE,
+        HB_SUBSET_SETS_LAYOUT_FEATURE_TAG, HB_SUBSET_SETS_DROP_TABLE_TAG
+    };
+    key k = fontKey;
+    k.add(engine);
+    k.add((uint32_t) in.get_flags());
+    for (auto st: sets)
+        k.add(in.set(st));
+    return k;
+}
+
+std::filesystem::path iftb::closure_cache::keyPath(const key &k) {
+    char buf[24];
+    snprintf(buf, sizeof(buf), "%016llx", (unsigned long long) k.name);
+    std::filesystem::path r = path;
+    r /= std::string(buf, 2);
+    r /= buf + 2;
+    return r;
+}
+
+/* The cache file format is the tag "ICLC", the check value as two 32-bit
+   numbers, a range count and then the first and last gid of each range.
+ */
+bool iftb::closure_cache::read(const key &k, iftb::wr_set &gids) {
+    std::ifstream ifs(keyPath(k), std::ios::binary);
+    if (!ifs)
+        return false;
+    std::stringstream ss;
+    ss << ifs.rdbuf();
+    std::string s = ss.str();
+    if (s.size() < 16)
+        return false;
+    simpleistream is(s.data(), s.size());
+    uint32_t tg = readObject<uint32_t>(is);
+    uint64_t check = (uint64_t) readObject<uint32_t>(is) << 32;
+    check |= readObject<uint32_t>(is);
+    uint32_t count = readObject<uint32_t>(is);
+    // A corrupt count must not wrap around to match a short entry
+    if (tg != tag("ICLC") || check != k.check ||
+        s.size() != 16 + (uint64_t) count * 8)
+        return false;
+    gids.clear();
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t first = readObject<uint32_t>(is);
+        uint32_t last = readObject<uint32_t>(is);
+        gids.add_range(first, last);
+    }
+    return true;
+}
+
+/* Writes to a temporary file first so that concurrent runs never see
+   a partial entry. Thread ids repeat across processes, so the temporary
+   name also has a random part.
+ */
+void iftb::closure_cache::write(const key &k, const iftb::wr_set &gids) {
+    std::filesystem::path p = keyPath(k), tp = p;
+    std::error_code ec;
+    std::filesystem::create_directories(p.parent_path(), ec);
+    std::random_device rd;
+    std::stringstream ts;
+    ts << ".tmp" << std::hex
+       << std::hash<std::thread::id>()(std::this_thread::get_id()) << "."
+       << rd() << rd();
+    tp += ts.str();
+
+    std::vector<std::pair<uint32_t, uint32_t>> ranges;
+    hb_codepoint_t first, last = HB_SET_VALUE_INVALID;
+    while (hb_set_next_range(gids.s, &first, &last))
+        ranges.emplace_back(first, last);
+
+    std::ofstream ofs(tp, std::ios::binary | std::ios::trunc);
+    writeObject(ofs, tag("ICLC"));
+    writeObject(ofs, (uint32_t) (k.check >> 32));
+    writeObject(ofs, (uint32_t) k.check);
+    writeObject(ofs, (uint32_t) ranges.size());
+    for (auto [f, l]: ranges) {
+        writeObject(ofs, f);
+        writeObject(ofs, l);
+    }
+    ofs.close();
+    if (!ofs) {
+        std::filesystem::remove(tp, ec);
+        return;
+    }
+    std::filesystem::rename(tp, p, ec);
+    if (ec)
+        std::filesystem::remove(tp, ec);
+}
+
+bool iftb::closure_cache::lookup(iftb::wr_subset_input &in, uint32_t engine,
+                                 iftb::wr_set &gids) {
+    if (!enabled())
+        return false;
+    if (read(makeKey(in, engine), gids)) {
+        hits++;
+        return true;
+    }
+    misses++;
+    return false;
+}
+
+void iftb::closure_cache::store(iftb::wr_subset_input &in, uint32_t engine,
+                                const iftb::wr_set &gids) {
+    if (enabled())
+        write(makeKey(in, engine), gids);
+}
+
+void iftb::closure_cache::plan_closure(iftb::wr_face &face,
+                                       iftb::wr_subset_input &in,
+                                       iftb::wr_set &gids) {
+    hb_subset_plan_t *plan = hb_subset_plan_create_or_fail(face.f, in.i);
+    hb_map_t *map = hb_subset_plan_old_to_new_glyph_mapping(plan);
+    gids.clear();
+    hb_map_keys(map, gids.s);
+    hb_subset_plan_destroy(plan);
+}
+
+void iftb::closure_cache::closure(iftb::wr_face &face,
+                                  iftb::wr_subset_input &in,
+                                  iftb::wr_set &gids) {
+    if (lookup(in, 0, gids))
+        return;
+    plan_closure(face, in, gids);
+    store(in, 0, gids);
+}
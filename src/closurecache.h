@@ -0,0 +1,73 @@
+/*
+Copyright 2023 Adobe
+All Rights Reserved.
+
+NOTICE: Adobe permits you to use, modify, and distribute this file in
+accordance with the terms of the Adobe license agreement accompanying
+it.
+*/
+
+/* The iftb::closure_cache object calculates harfbuzz glyph closures and
+   optionally stores the results in a directory, keyed by a hash of the
+   font data, the harfbuzz version and the subset input flags and sets.
+   Later runs on the same font can then skip the subset plan calculation.
+   It is only included in the encoder.
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+
+#include "wrappers.h"
+
+#pragma once
+
+namespace iftb {
+    class closure_cache;
+}
+
+class iftb::closure_cache {
+ public:
+    // An empty path disables the cache
+    void setPath(const std::filesystem::path &p);
+    bool enabled() const { return !path.empty(); }
+    // Must be called with the data of the font face is created from
+    void setFont(const char *data, size_t length);
+    void setFont(iftb::wr_blob &b) {
+        unsigned int l;
+        const char *d = hb_blob_get_data(b.b, &l);
+        setFont(d, l);
+    }
+    /* Sets gids to the glyph closure of the input sets on face, reading
+       it from the cache if present and storing it otherwise. Safe to
+       call from multiple threads as long as each passes its own input.
+     */
+    void closure(iftb::wr_face &face, iftb::wr_subset_input &in,
+                 iftb::wr_set &gids);
+    /* Lower level access for closures calculated some other way. engine
+       distinguishes results of different closure calculations.
+     */
+    bool lookup(iftb::wr_subset_input &in, uint32_t engine,
+                iftb::wr_set &gids);
+    void store(iftb::wr_subset_input &in, uint32_t engine,
+               const iftb::wr_set &gids);
+    // Sets gids to the glyph closure of a subset plan, without caching
+    static void plan_closure(iftb::wr_face &face, iftb::wr_subset_input &in,
+                             iftb::wr_set &gids);
+    uint32_t hitCount() const { return hits; }
+    uint32_t missCount() const { return misses; }
+ private:
+    struct key {
+        uint64_t name = 0xcbf29ce484222325, check = 0x84222325cbf29ce4;
+        void add(uint32_t v);
+        void add(const char *data, size_t length);
+        void add(const hb_set_t *s);
+    };
+    key makeKey(iftb::wr_subset_input &in, uint32_t engine);
+    std::filesystem::path keyPath(const key &k);
+    bool read(const key &k, iftb::wr_set &gids);
+    void write(const key &k, const iftb::wr_set &gids);
+    std::filesystem::path path;
+    key fontKey;
+    std::atomic<uint32_t> hits {0}, misses {0};
+};
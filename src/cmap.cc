@@ -11,6 +11,7 @@ it.
 
 #include "cmap.h"
 #include "streamhelp.h"
+#include "table_IFTB_view.h"
 
 struct type4seg {
     type4seg() {}
@@ -19,9 +20,8 @@ struct type4seg {
     int16_t idDelta {0};
 };
 
-bool iftb::readcmap(std::istream &is,
-                    std::unordered_map<uint32_t, uint16_t> &uniMap,
-                    std::vector<uint16_t> *gidMap) {
+bool iftb::readcmap(spanreader &is, iftb::unicode_map &uniMap,
+                    iftb::table_IFTB_view *gidMap) {
     uint16_t numTables, platformID, encodingID;
     uint32_t subtableOffset, candidateOffset = 0;
     readObject<uint16_t>(is);  // version
@@ -45,7 +45,7 @@ bool iftb::readcmap(std::istream &is,
         std::cerr << "cmap error: No appropriate subtable" << std::endl;
         return false;
     }
-    is.seekg(candidateOffset);
+    is.seek(candidateOffset);
     uint16_t format;
     readObject(is, format);
     if (format == 4) {
@@ -66,7 +66,7 @@ bool iftb::readcmap(std::istream &is,
             readObject(is, segs[i].startCode);
         for (uint32_t i = 0; i < segCount; i++)
             readObject(is, segs[i].idDelta);
-        uint32_t firstidroOff = is.tellg();
+        uint32_t firstidroOff = is.tell();
         for (uint32_t i = 0; i < segCount; i++) {
             readObject(is, segs[i].idRangeOffset);
         }
@@ -83,21 +83,16 @@ bool iftb::readcmap(std::istream &is,
                 if (s.idRangeOffset != 0) {
                     uint32_t t = s.idRangeOffset + 2 * (c - s.startCode);
                     t += firstidroOff + 2 * idx;
-                    is.seekg(t);
+                    is.seek(t);
                     readObject(is, gid);
                 } else
                     gid = c + s.idDelta;
-                if (gidMap && gid >= gidMap->size()) {
+                if (gidMap && gid >= gidMap->getGlyphCount()) {
                     std::cerr << "cmap format 4 bad gid value";
                     std::cerr << std::endl;
                     return false;
                 }
-                if (gidMap) {
-                    uint16_t ck = (*gidMap)[gid];
-                    if (ck != 0)
-                        uniMap.emplace(c, ck);
-                } else
-                    uniMap.emplace(c, gid);
+                uniMap.add(c, gidMap ? gidMap->getGIDChunk(gid) : gid);
             }
         }
     } else if (format == 12) {
@@ -118,17 +113,12 @@ bool iftb::readcmap(std::istream &is,
             }
             for (uint32_t c = startCharCode; c <= endCharCode; c++) {
                 uint16_t gid = startGlyphID + c - startCharCode;
-                if (gidMap && gid >= gidMap->size()) {
+                if (gidMap && gid >= gidMap->getGlyphCount()) {
                     std::cerr << "cmap format 12 bad gid value";
                     std::cerr << std::endl;
                     return false;
                 }
-                if (gidMap) {
-                    uint16_t ck = (*gidMap)[gid];
-                    if (ck != 0)
-                        uniMap.emplace(c, ck);
-                } else
-                    uniMap.emplace(c, gid);
+                uniMap.add(c, gidMap ? gidMap->getGIDChunk(gid) : gid);
             }
         }
     } else {
@@ -141,5 +131,6 @@ bool iftb::readcmap(std::istream &is,
         std::cerr << format << std::endl;
         return false;
     }
+    uniMap.finish();
     return true;
 }
@@ -13,13 +13,66 @@ it.
 
 #include <iostream>
 #include <vector>
-#include <unordered_map>
 #include <cstdint>
 
+#include "streamhelp.h"
+
 #pragma once
 
 namespace iftb {
-    bool readcmap(std::istream &is,
-                  std::unordered_map<uint32_t, uint16_t> &uniMap,
-                  std::vector<uint16_t> *gidMap);
+    class unicode_map;
+    class table_IFTB_view;
+    /* Maps each codepoint to its chunk index via the gid map of an IFTB
+       table or, when gidMap is null, to its glyph ID.
+     */
+    bool readcmap(spanreader &is, iftb::unicode_map &uniMap,
+                  iftb::table_IFTB_view *gidMap);
 }
+
+/* Maps codepoints to 16-bit values with a two-level page table: an
+   index per 256-codepoint page that selects a block of 256 values. Pages
+   with no mapped codepoints share an all-zero block, so a large font
+   takes about one block per populated page rather than one hash node per
+   codepoint. As with a hash map emplace, the first non-zero value added
+   for a codepoint is the one kept.
+ */
+class iftb::unicode_map {
+ public:
+    unicode_map() : blocks(pageSize, 0) {}
+    void add(uint32_t cp, uint16_t v) {
+        if (v == 0)
+            return;
+        uint32_t p = cp >> pageBits;
+        if (p >= pages.size())
+            pages.resize(p + 1, 0);
+        if (pages[p] == 0) {
+            pages[p] = blocks.size() / pageSize;
+            blocks.resize(blocks.size() + pageSize, 0);
+        }
+        uint16_t &e = blocks[pages[p] * pageSize + (cp & (pageSize - 1))];
+        if (e == 0)
+            e = v;
+    }
+    void finish() {
+        pages.shrink_to_fit();
+        blocks.shrink_to_fit();
+    }
+    // Returns 0 for unmapped codepoints
+    uint16_t get(uint32_t cp) const {
+        uint32_t p = cp >> pageBits;
+        if (p >= pages.size())
+            return 0;
+        return blocks[pages[p] * pageSize + (cp & (pageSize - 1))];
+    }
+    // The number of pages with mapped codepoints
+    size_t pageCount() const { return blocks.size() / pageSize - 1; }
+    void clear() {
+        pages.clear();
+        blocks.assign(pageSize, 0);
+    }
+ private:
+    static const uint32_t pageBits = 8, pageSize = 1 << pageBits;
+    // Block index per page, where block 0 is all zeros
+    std::vector<uint16_t> pages;
+    std::vector<uint16_t> blocks;
+};
@@ -0,0 +1,151 @@
+/*
+Copyright 2023 Adobe
+All Rights Reserved.
+
+NOTICE: Adobe permits you to use, modify, and distribute this file in
+accordance with the terms of the Adobe license agreement accompanying
+it.
+*/
+
+/* Decoding of UTF-8 and UTF-16 text to codepoints, and iftb::codepoint_set
+   for deduplicating them, so that the client can take text directly
+   rather than a list of codepoints built from it. Ill-formed sequences
+   are skipped rather than decoded as U+FFFD, as they name no character
+   the font could supply.
+ */
+
+#include <array>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+
+#pragma once
+
+namespace iftb {
+    class codepoint_set;
+    template<class F>
+    void decodeUTF8(const char *buf, size_t length, F &&f);
+    template<class F>
+    void decodeUTF16(const uint16_t *buf, size_t length, F &&f);
+}
+
+/* A bitset over all codepoints, allocated 4096 codepoints at a time, so
+   that text in a few scripts touches a few blocks.
+ */
+class iftb::codepoint_set {
+ public:
+    // Returns false if cp was already in the set or is not a codepoint
+    bool insert(uint32_t cp) {
+        if (cp > max_codepoint)
+            return false;
+        auto &b = blocks[cp >> 12];
+        if (b.empty())
+            b.resize(64, 0);
+        uint64_t &w = b[(cp >> 6) & 63], m = 1ULL << (cp & 63);
+        if (w & m)
+            return false;
+        w |= m;
+        n++;
+        return true;
+    }
+    bool test(uint32_t cp) const {
+        if (cp > max_codepoint)
+            return false;
+        auto &b = blocks[cp >> 12];
+        return !b.empty() && (b[(cp >> 6) & 63] >> (cp & 63) & 1);
+    }
+    uint32_t size() const { return n; }
+    // Keeps the allocated blocks for reuse
+    void clear() {
+        for (auto &b: blocks)
+            for (auto &w: b)
+                w = 0;
+        n = 0;
+    }
+ private:
+    static const uint32_t max_codepoint = 0x10FFFF;
+    std::array<std::vector<uint64_t>, (max_codepoint >> 12) + 1> blocks;
+    uint32_t n {0};
+};
+
+/* Calls f with each codepoint of UTF-8 text. Runs of ASCII are tested
+   eight bytes at a time, and the three byte sequences of CJK (and most
+   other BMP) text are decoded before the general case.
+ */
+template<class F>
+void iftb::decodeUTF8(const char *buf, size_t length, F &&f) {
+    const uint8_t *p = (const uint8_t *) buf, *end = p + length;
+    while (p < end) {
+        if (end - p >= 8) {
+            uint64_t w;
+            memcpy(&w, p, 8);
+            if ((w & 0x8080808080808080ULL) == 0) {
+                for (int k = 0; k < 8; k++)
+                    f((uint32_t) p[k]);
+                p += 8;
+                continue;
+            }
+        }
+        uint32_t c = p[0], cp;
+        if (c < 0x80) {
+            f(c);
+            p++;
+        } else if ((c & 0xF0) == 0xE0 && end - p >= 3 &&
+                   (p[1] & 0xC0) == 0x80 && (p[2] & 0xC0) == 0x80 &&
+                   (cp = (c & 0x0F) << 12 | (p[1] & 0x3F) << 6 |
+                         (p[2] & 0x3F)) >= 0x800 &&
+                   (cp < 0xD800 || cp > 0xDFFF)) {
+            f(cp);
+            p += 3;
+        } else if ((c & 0xE0) == 0xC0 && c >= 0xC2 && end - p >= 2 &&
+                   (p[1] & 0xC0) == 0x80) {
+            f((c & 0x1F) << 6 | (p[1] & 0x3F));
+            p += 2;
+        } else if ((c & 0xF8) == 0xF0 && end - p >= 4 &&
+                   (p[1] & 0xC0) == 0x80 && (p[2] & 0xC0) == 0x80 &&
+                   (p[3] & 0xC0) == 0x80 &&
+                   (cp = (c & 0x07) << 18 | (p[1] & 0x3F) << 12 |
+                         (p[2] & 0x3F) << 6 | (p[3] & 0x3F)) >= 0x10000 &&
+                   cp <= 0x10FFFF) {
+            f(cp);
+            p += 4;
+        } else {
+            p++;
+        }
+    }
+}
+
+/* Calls f with each codepoint of UTF-16 text in native byte order. Four
+   code units at a time are checked for surrogates, which most text
+   (including CJK) does not have.
+ */
+template<class F>
+void iftb::decodeUTF16(const uint16_t *buf, size_t length, F &&f) {
+    const uint64_t ones = 0x0001000100010001ULL;
+    size_t i = 0;
+    while (i < length) {
+        if (length - i >= 4) {
+            uint64_t w;
+            memcpy(&w, buf + i, 8);
+            // A lane is zero where a unit is a surrogate
+            uint64_t x = (w & 0xF800 * ones) ^ 0xD800 * ones;
+            if (((x - ones) & ~x & 0x8000 * ones) == 0) {
+                for (int k = 0; k < 4; k++)
+                    f((uint32_t) buf[i + k]);
+                i += 4;
+                continue;
+            }
+        }
+        uint32_t u = buf[i];
+        if ((u & 0xF800) != 0xD800) {
+            f(u);
+            i++;
+        } else if (u < 0xDC00 && i + 1 < length &&
+                   (buf[i + 1] & 0xFC00) == 0xDC00) {
+            f(0x10000 + ((u - 0xD800) << 10) + (buf[i + 1] - 0xDC00));
+            i += 2;
+        } else {
+            i++;
+        }
+    }
+}
@@ -11,6 +11,7 @@ it.
 #include <cmath>
 
 #include "config.h"
+#include "chunk.h"
 
 void iftb::config::setNumChunks(uint16_t numChunks) {
     uint8_t nbits = ilogb(numChunks) + 1, nhd; 
@@ -136,6 +137,31 @@ bool iftb::config::prepDir(std::filesystem::path &p, bool thrw) {
     return true;
 }
 
+void iftb::config::copySettings(iftb::config &c) {
+    _verbosity = c._verbosity;
+    base_points.copy(c.base_points);
+    used_points.copy(c.used_points);
+    group_info = c.group_info;
+    ordered_point_groups = c.ordered_point_groups;
+    point_groups.clear();
+    for (auto &s: c.point_groups) {
+        iftb::wr_set n;
+        n.copy(s);
+        point_groups.push_back(std::move(n));
+    }
+    feat_subset_cutoff = c.feat_subset_cutoff;
+    target_chunk_size = c.target_chunk_size;
+    num_jobs = c.num_jobs;
+    use_glyph_graph = c.use_glyph_graph;
+    use_light_closures = c.use_light_closures;
+    brotli_settings = c.brotli_settings;
+    chunk_dictionary_size = c.chunk_dictionary_size;
+    store_chunk_sizes = c.store_chunk_sizes;
+    store_codepoint_ranges = c.store_codepoint_ranges;
+    rangeFilename = c.rangeFilename;
+    closure_cache_path = c.closure_cache_path;
+}
+
 int iftb::config::load(std::string p, bool is_default) {
     auto yc = YAML::LoadFile(p.c_str());
 
@@ -153,6 +179,49 @@ int iftb::config::load(std::string p, bool is_default) {
     auto targ_chunk_sz = yc["target_chunk_size"];
     if (targ_chunk_sz.IsScalar())
         target_chunk_size = targ_chunk_sz.as<uint32_t>();
+    auto glyph_graph = yc["glyph_graph"];
+    if (glyph_graph.IsScalar())
+        use_glyph_graph = glyph_graph.as<bool>();
+    auto light_closures = yc["light_closures"];
+    if (light_closures.IsScalar())
+        use_light_closures = light_closures.as<bool>();
+    auto bquality = yc["brotli_quality"];
+    if (bquality.IsScalar()) {
+        brotli_settings.quality = bquality.as<int>();
+        if (   brotli_settings.quality < BROTLI_MIN_QUALITY
+            || brotli_settings.quality > BROTLI_MAX_QUALITY)
+            throw YAML::Exception(bquality.Mark(), "brotli_quality must be between 0 and 11");
+    }
+    auto blgwin = yc["brotli_lgwin"];
+    if (blgwin.IsScalar()) {
+        brotli_settings.lgwin = blgwin.as<int>();
+        if (   brotli_settings.lgwin < BROTLI_MIN_WINDOW_BITS
+            || brotli_settings.lgwin > BROTLI_MAX_WINDOW_BITS)
+            throw YAML::Exception(blgwin.Mark(), "brotli_lgwin must be between 10 and 24");
+    }
+    auto dict_size = yc["chunk_dictionary_size"];
+    if (dict_size.IsScalar())
+        chunk_dictionary_size = dict_size.as<uint32_t>();
+    auto chunk_sizes = yc["chunk_sizes"];
+    if (chunk_sizes.IsScalar())
+        store_chunk_sizes = chunk_sizes.as<bool>();
+    auto cp_ranges = yc["codepoint_ranges"];
+    if (cp_ranges.IsScalar())
+        store_codepoint_ranges = cp_ranges.as<bool>();
+    auto bmode = yc["brotli_mode"];
+    if (bmode.IsScalar()) {
+        std::string m = bmode.Scalar();
+        if (m == "auto")
+            brotli_settings.automatic = true;
+        else if (m == "font")
+            brotli_settings.mode = BROTLI_MODE_FONT;
+        else if (m == "generic")
+            brotli_settings.mode = BROTLI_MODE_GENERIC;
+        else if (m == "text")
+            brotli_settings.mode = BROTLI_MODE_TEXT;
+        else
+            throw YAML::Exception(bmode.Mark(), "brotli_mode must be font, generic, text or auto");
+    }
 
     if (verbosity() <= 2)
         return 0;
@@ -160,6 +229,13 @@ int iftb::config::load(std::string p, bool is_default) {
     std::cerr << "Config:" << std::endl;
     std::cerr << "  feature subsetting cutoff size: " << feat_subset_cutoff << std::endl;
     std::cerr << "  target chunk size: " << target_chunk_size << std::endl;
+    std::cerr << "  use glyph graph: " << (use_glyph_graph ? "yes" : "no") << std::endl;
+    std::cerr << "  use light closures: " << (use_light_closures ? "yes" : "no") << std::endl;
+    std::cerr << "  brotli quality: " << brotli_settings.quality << ", lgwin: " << brotli_settings.lgwin;
+    std::cerr << ", mode: " << (brotli_settings.automatic ? "auto" : iftb::chunk::modeName(brotli_settings.mode)) << std::endl;
+    std::cerr << "  chunk dictionary size: " << chunk_dictionary_size << std::endl;
+    std::cerr << "  store chunk sizes: " << (store_chunk_sizes ? "yes" : "no") << std::endl;
+    std::cerr << "  store codepoint ranges: " << (store_codepoint_ranges ? "yes" : "no") << std::endl;
     std::cerr << "  base point population: " << base_points.size() << std::endl;
     std::cerr << "  total point population: " << used_points.size() << std::endl;
     std::cerr << "  # of ordered point groups: " << ordered_point_groups.size();
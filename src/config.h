@@ -15,12 +15,14 @@ it.
 #include <filesystem>
 
 #include "yaml-cpp/yaml.h"
+#include <brotli/encode.h>
 
 #include "wrappers.h"
 
 #pragma once
 
 namespace iftb {
+    struct brotli_params;
     struct group_wrapper;
     class config;
     typedef std::vector<std::unique_ptr<group_wrapper>> wrapped_groups;
@@ -32,6 +34,14 @@ struct iftb::group_wrapper {
     virtual ~group_wrapper() = default;
 };
 
+struct iftb::brotli_params {
+    int quality = BROTLI_MAX_QUALITY;
+    int lgwin = BROTLI_DEFAULT_WINDOW;
+    BrotliEncoderMode mode = BROTLI_MODE_FONT;
+    // Also try the other modes and the largest window, keeping the smallest
+    bool automatic = false;
+};
+
 class iftb::config {
  public:
     friend class iftb::chunker;
@@ -95,6 +105,9 @@ class iftb::config {
     }
 
     int load(std::string p, bool is_default);
+    // Copies everything but the per-font output paths, so that a config
+    // file loaded once can be used for many fonts
+    void copySettings(iftb::config &c);
 
     void makeChunkDirs() {
         if (chunk_hex_digits > 2)
@@ -126,6 +139,18 @@ class iftb::config {
     bool printConfig() { return true; }
     bool noCatch() { return true; }
     uint32_t mini_targ() { return target_chunk_size / 4; }
+    bool glyph_graph() { return use_glyph_graph; }
+    bool light_closures() { return use_light_closures; }
+    const iftb::brotli_params &brotli() { return brotli_settings; }
+    uint32_t dictionary_size() { return chunk_dictionary_size; }
+    bool chunk_sizes() { return store_chunk_sizes; }
+    bool codepoint_ranges() { return store_codepoint_ranges; }
+    void setJobs(uint16_t j) { num_jobs = j > 0 ? j : 1; }
+    uint16_t jobs() { return num_jobs; }
+    void setClosureCachePath(const std::filesystem::path &p) {
+        closure_cache_path = p;
+    }
+    std::filesystem::path closureCachePath() { return closure_cache_path; }
  private:
     struct point_group_info {
         point_group_info() {}
@@ -174,6 +199,13 @@ class iftb::config {
     uint32_t target_chunk_size = 0x8FFF;
     uint8_t chunk_hex_digits = 0;
     uint8_t chunk_dir_levels = 0;
+    uint16_t num_jobs = 1;
+    bool use_glyph_graph = false;
+    bool use_light_closures = false;
+    iftb::brotli_params brotli_settings;
+    uint32_t chunk_dictionary_size = 0;
+    bool store_chunk_sizes = false;
+    bool store_codepoint_ranges = false;
     std::string rangeFilename = "rangefile";
-    std::filesystem::path _inputPath, pathPrefix;
+    std::filesystem::path _inputPath, pathPrefix, closure_cache_path;
 };
@@ -0,0 +1,418 @@
+/*
+Copyright 2023 Adobe
+All Rights Reserved.
+
+NOTICE: Adobe permits you to use, modify, and distribute this file in
+accordance with the terms of the Adobe license agreement accompanying
+it.
+*/
+
+#include <algorithm>
+#include <cassert>
+
+#include "glyphgraph.h"
+#include "streamhelp.h"
+
+bool iftb::glyph_graph::read_coverage(std::istream &is, uint32_t off,
+                                      std::vector<uint16_t> &gids) {
+    uint16_t format, count;
+    gids.clear();
+    is.seekg(off);
+    readObject(is, format);
+    readObject(is, count);
+    if (format == 1) {
+        gids.resize(count);
+        for (auto &g: gids)
+            readObject(is, g);
+    } else if (format == 2) {
+        for (uint32_t i = 0; i < count; i++) {
+            uint16_t start, end, startIndex;
+            readObject(is, start);
+            readObject(is, end);
+            readObject(is, startIndex);
+            if (start > end)
+                return false;
+            if (gids.size() < startIndex + (end - start) + 1)
+                gids.resize(startIndex + (end - start) + 1);
+            for (uint32_t g = start; g <= end; g++)
+                gids[startIndex + g - start] = g;
+        }
+    } else
+        return false;
+    return !is.fail();
+}
+
+bool iftb::glyph_graph::add_subtable_edges(std::istream &is, uint16_t type,
+                                           uint32_t off) {
+    uint16_t format, covOffset, count, u16;
+    std::vector<uint16_t> cov, offs;
+
+    is.seekg(off);
+    readObject(is, format);
+    readObject(is, covOffset);
+    switch (type) {
+        case 1:  // Single
+            if (format == 1) {
+                readObject(is, u16);  // deltaGlyphID
+                if (!read_coverage(is, off + covOffset, cov))
+                    return false;
+                for (auto g: cov)
+                    add_edge(g, (uint16_t) (g + u16));
+            } else if (format == 2) {
+                readObject(is, count);
+                offs.resize(count);
+                for (auto &s: offs)
+                    readObject(is, s);
+                if (!read_coverage(is, off + covOffset, cov))
+                    return false;
+                for (uint32_t i = 0; i < cov.size() && i < count; i++)
+                    add_edge(cov[i], offs[i]);
+            } else
+                return false;
+            break;
+        case 2:  // Multiple
+        case 3:  // Alternate
+        case 4:  // Ligature
+            if (format != 1)
+                return false;
+            readObject(is, count);
+            offs.resize(count);
+            for (auto &s: offs)
+                readObject(is, s);
+            if (!read_coverage(is, off + covOffset, cov))
+                return false;
+            for (uint32_t i = 0; i < cov.size() && i < count; i++) {
+                uint32_t setOff = off + offs[i];
+                uint16_t n;
+                is.seekg(setOff);
+                readObject(is, n);
+                if (type != 4) {
+                    for (uint32_t j = 0; j < n; j++)
+                        add_edge(cov[i], readObject<uint16_t>(is));
+                } else {
+                    // The coverage glyph is the first component, which
+                    // must be present for the ligature to be formed.
+                    std::vector<uint16_t> ligOffs(n);
+                    for (auto &l: ligOffs)
+                        readObject(is, l);
+                    for (auto l: ligOffs) {
+                        is.seekg(setOff + l);
+                        add_edge(cov[i], readObject<uint16_t>(is));
+                    }
+                }
+            }
+            break;
+        case 5:  // Context
+        case 6:  // Chained context
+            // The nested lookups do the substituting and all lookups are
+            // added, so the context only restricts what they do.
+            break;
+        case 8:  // Reverse chained single
+            if (format != 1)
+                return false;
+            readObject(is, count);  // backtrack
+            is.seekg(count * 2, std::ios_base::cur);
+            readObject(is, count);  // lookahead
+            is.seekg(count * 2, std::ios_base::cur);
+            readObject(is, count);
+            offs.resize(count);
+            for (auto &s: offs)
+                readObject(is, s);
+            if (!read_coverage(is, off + covOffset, cov))
+                return false;
+            for (uint32_t i = 0; i < cov.size() && i < count; i++)
+                add_edge(cov[i], offs[i]);
+            break;
+        default:
+            return false;
+    }
+    return !is.fail();
+}
+
+/* Every lookup in the table is included, whether or not a feature refers
+   to it, so that lookups only reachable through contextual lookups are
+   covered.
+ */
+bool iftb::glyph_graph::add_gsub_edges(const char *buf, uint32_t length) {
+    uint16_t majorVersion, lookupListOffset, lookupCount;
+    std::vector<uint16_t> lookupOffsets;
+    simpleistream is(buf, length);
+
+    if (length == 0)
+        return true;
+    readObject(is, majorVersion);
+    if (majorVersion != 1)
+        return false;
+    is.seekg(8);
+    readObject(is, lookupListOffset);
+    is.seekg(lookupListOffset);
+    readObject(is, lookupCount);
+    lookupOffsets.resize(lookupCount);
+    for (auto &l: lookupOffsets)
+        readObject(is, l);
+    for (auto l: lookupOffsets) {
+        uint32_t lOff = lookupListOffset + l;
+        uint16_t type, subTableCount;
+        std::vector<uint16_t> subOffsets;
+        is.seekg(lOff);
+        readObject(is, type);
+        readObject<uint16_t>(is);  // lookupFlag
+        readObject(is, subTableCount);
+        subOffsets.resize(subTableCount);
+        for (auto &s: subOffsets)
+            readObject(is, s);
+        for (auto s: subOffsets) {
+            uint32_t sOff = lOff + s;
+            uint16_t stype = type;
+            if (type == 7) {  // Extension
+                uint32_t extOffset;
+                is.seekg(sOff + 2);
+                readObject(is, stype);
+                readObject(is, extOffset);
+                sOff += extOffset;
+            }
+            if (!add_subtable_edges(is, stype, sOff))
+                return false;
+        }
+    }
+    return !is.fail();
+}
+
+bool iftb::glyph_graph::add_glyf_edges(
+                        const std::vector<iftb::merger::glyphrec> &recs) {
+    const uint16_t ARG_1_AND_2_ARE_WORDS = 0x0001, WE_HAVE_A_SCALE = 0x0008,
+                   MORE_COMPONENTS = 0x0020,
+                   WE_HAVE_AN_X_AND_Y_SCALE = 0x0040,
+                   WE_HAVE_A_TWO_BY_TWO = 0x0080;
+    for (uint32_t gid = 0; gid < recs.size(); gid++) {
+        auto &r = recs[gid];
+        if (r.length < 10)
+            continue;
+        simpleistream is(r.offset, r.length);
+        if (readObject<int16_t>(is) >= 0)
+            continue;  // Not a composite
+        is.seekg(10);
+        uint16_t flags;
+        do {
+            readObject(is, flags);
+            add_edge(gid, readObject<uint16_t>(is));
+            uint32_t skip = (flags & ARG_1_AND_2_ARE_WORDS) ? 4 : 2;
+            if (flags & WE_HAVE_A_SCALE)
+                skip += 2;
+            else if (flags & WE_HAVE_AN_X_AND_Y_SCALE)
+                skip += 4;
+            else if (flags & WE_HAVE_A_TWO_BY_TWO)
+                skip += 8;
+            is.seekg(skip, std::ios_base::cur);
+        } while ((flags & MORE_COMPONENTS) && !is.fail());
+        if (is.fail())
+            return false;
+    }
+    return true;
+}
+
+/* Assumes the charstrings have been desubroutinized. */
+bool iftb::glyph_graph::cff_has_seac(
+                        const std::vector<iftb::merger::glyphrec> &recs) {
+    for (auto &r: recs) {
+        const uint8_t *p = (const uint8_t *) r.offset;
+        uint32_t i = 0, nargs = 0, nstems = 0;
+        while (i < r.length) {
+            uint8_t b0 = p[i];
+            if (b0 >= 32 || b0 == 28) {
+                if (b0 == 28)
+                    i += 3;
+                else if (b0 <= 246)
+                    i += 1;
+                else if (b0 <= 254)
+                    i += 2;
+                else
+                    i += 5;
+                nargs++;
+                continue;
+            }
+            switch (b0) {
+                case 1:   // hstem
+                case 3:   // vstem
+                case 18:  // hstemhm
+                case 23:  // vstemhm
+                    nstems += nargs / 2;
+                    break;
+                case 19:  // hintmask
+                case 20:  // cntrmask
+                    nstems += nargs / 2;
+                    i += (nstems + 7) / 8;
+                    break;
+                case 12:  // escape
+                    i++;
+                    break;
+                case 14:  // endchar
+                    if (nargs >= 4)
+                        return true;
+                    break;
+            }
+            nargs = 0;
+            i++;
+        }
+    }
+    return false;
+}
+
+void iftb::glyph_graph::finalize() {
+    std::sort(edges.begin(), edges.end());
+    edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+    offsets.assign(glyphCount + 1, 0);
+    targets.clear();
+    targets.reserve(edges.size());
+    for (auto &[from, to]: edges) {
+        offsets[from + 1]++;
+        targets.push_back(to);
+    }
+    for (uint32_t i = 0; i < glyphCount; i++)
+        offsets[i + 1] += offsets[i];
+    edges.clear();
+    edges.shrink_to_fit();
+}
+
+void iftb::glyph_graph::reach(const iftb::wr_set &from, iftb::wr_set &to) {
+    std::vector<uint32_t> stack;
+    std::vector<bool> seen(glyphCount);
+    uint32_t gid = HB_SET_VALUE_INVALID;
+    to.clear();
+    while (from.next(gid)) {
+        if (gid < glyphCount && !seen[gid]) {
+            seen[gid] = true;
+            stack.push_back(gid);
+        }
+    }
+    while (!stack.empty()) {
+        gid = stack.back();
+        stack.pop_back();
+        to.add(gid);
+        for (uint32_t i = offsets[gid]; i < offsets[gid + 1]; i++) {
+            if (!seen[targets[i]]) {
+                seen[targets[i]] = true;
+                stack.push_back(targets[i]);
+            }
+        }
+    }
+}
+
+/* Node 0 is a root with an edge to each source node and to the glyphs in
+   always, nodes 1 to sources.size() are the sources and the glyph nodes
+   follow. The dominator tree is found with the iterative algorithm of
+   Cooper, Harvey and Kennedy ("A Simple, Fast Dominance Algorithm").
+ */
+void iftb::glyph_graph::dominate(const std::vector<iftb::wr_set> &sources,
+                                 const iftb::wr_set &always,
+                                 std::vector<uint32_t> &owner) {
+    const uint32_t UNDEF = (uint32_t) -1;
+    uint32_t firstGlyph = sources.size() + 1;
+    uint32_t numNodes = firstGlyph + glyphCount;
+    std::vector<uint32_t> soff(numNodes + 1, 0), succ;
+    std::vector<uint32_t> poff(numNodes + 1, 0), pred;
+    uint32_t gid;
+
+    // Successor lists, in the same layout as offsets/targets
+    succ.reserve(targets.size() + numNodes);
+    for (uint32_t s = 0; s < sources.size(); s++)
+        succ.push_back(s + 1);
+    gid = HB_SET_VALUE_INVALID;
+    while (always.next(gid))
+        if (gid < glyphCount)
+            succ.push_back(firstGlyph + gid);
+    soff[1] = succ.size();
+    for (uint32_t s = 0; s < sources.size(); s++) {
+        gid = HB_SET_VALUE_INVALID;
+        while (sources[s].next(gid))
+            if (gid < glyphCount)
+                succ.push_back(firstGlyph + gid);
+        soff[s + 2] = succ.size();
+    }
+    for (uint32_t g = 0; g < glyphCount; g++) {
+        for (uint32_t i = offsets[g]; i < offsets[g + 1]; i++)
+            succ.push_back(firstGlyph + targets[i]);
+        soff[firstGlyph + g + 1] = succ.size();
+    }
+
+    // Predecessor lists
+    for (auto n: succ)
+        poff[n + 1]++;
+    for (uint32_t n = 0; n < numNodes; n++)
+        poff[n + 1] += poff[n];
+    pred.resize(succ.size());
+    {
+        std::vector<uint32_t> fill(poff.begin(), poff.end() - 1);
+        for (uint32_t n = 0; n < numNodes; n++)
+            for (uint32_t i = soff[n]; i < soff[n + 1]; i++)
+                pred[fill[succ[i]]++] = n;
+    }
+
+    // Depth-first postorder numbering from the root
+    std::vector<uint32_t> po(numNodes, UNDEF), rpo;
+    std::vector<std::pair<uint32_t, uint32_t>> stack;
+    rpo.reserve(numNodes);
+    po[0] = 0;
+    stack.emplace_back(0, soff[0]);
+    while (!stack.empty()) {
+        auto &[n, i] = stack.back();
+        if (i < soff[n + 1]) {
+            uint32_t m = succ[i++];
+            if (po[m] == UNDEF) {
+                po[m] = 0;  // Visited, not yet numbered
+                stack.emplace_back(m, soff[m]);
+            }
+        } else {
+            po[n] = rpo.size();
+            rpo.push_back(n);
+            stack.pop_back();
+        }
+    }
+    std::reverse(rpo.begin(), rpo.end());
+
+    std::vector<uint32_t> idom(numNodes, UNDEF);
+    idom[0] = 0;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (auto n: rpo) {
+            if (n == 0)
+                continue;
+            uint32_t nd = UNDEF;
+            for (uint32_t i = poff[n]; i < poff[n + 1]; i++) {
+                uint32_t p = pred[i];
+                if (idom[p] == UNDEF)
+                    continue;
+                if (nd == UNDEF) {
+                    nd = p;
+                    continue;
+                }
+                uint32_t a = p, b = nd;
+                while (a != b) {
+                    while (po[a] < po[b])
+                        a = idom[a];
+                    while (po[b] < po[a])
+                        b = idom[b];
+                }
+                nd = a;
+            }
+            if (idom[n] != nd) {
+                idom[n] = nd;
+                changed = true;
+            }
+        }
+    }
+
+    // The owner of a node is the child of the root that dominates it,
+    // if that child is a source.
+    std::vector<uint32_t> nowner(numNodes, UNREACHED);
+    for (auto n: rpo) {
+        if (n == 0)
+            continue;
+        if (idom[n] == 0)
+            nowner[n] = (n < firstGlyph) ? n - 1 : NO_SOURCE;
+        else
+            nowner[n] = nowner[idom[n]];
+    }
+    owner.assign(nowner.begin() + firstGlyph, nowner.end());
+}
@@ -0,0 +1,69 @@
+/*
+Copyright 2023 Adobe
+All Rights Reserved.
+
+NOTICE: Adobe permits you to use, modify, and distribute this file in
+accordance with the terms of the Adobe license agreement accompanying
+it.
+*/
+
+/* The iftb::glyph_graph object records which glyphs can be pulled into
+   a glyph closure by the presence of other glyphs, as a directed graph.
+   The edges over-approximate the harfbuzz closure (a ligature is reachable
+   from its first component alone, contextual lookups are treated as
+   unconditional) so a glyph the graph can't reach is also absent from
+   the real closure. It is only included in the encoder.
+ */
+
+#include <vector>
+#include <utility>
+#include <cstdint>
+
+#include "merger.h"
+#include "wrappers.h"
+
+#pragma once
+
+namespace iftb {
+    class glyph_graph;
+}
+
+class iftb::glyph_graph {
+ public:
+    // Values of dominate() owner entries that are not source indexes
+    static constexpr uint32_t NO_SOURCE = (uint32_t) -1;
+    static constexpr uint32_t UNREACHED = (uint32_t) -2;
+
+    glyph_graph(uint32_t glyph_count) : glyphCount(glyph_count) {}
+    void add_edge(uint32_t from, uint32_t to) {
+        if (from < glyphCount && to < glyphCount && from != to)
+            edges.emplace_back(from, to);
+    }
+    // Adds an edge from each GSUB input glyph to each of its substitutes
+    bool add_gsub_edges(const char *buf, uint32_t length);
+    // Adds an edge from each composite glyph to its components
+    bool add_glyf_edges(const std::vector<iftb::merger::glyphrec> &recs);
+    // True if any CFF charstring uses the deprecated seac form of endchar
+    static bool cff_has_seac(const std::vector<iftb::merger::glyphrec> &recs);
+    // Must be called after the last edge is added
+    void finalize();
+    // Sets to to the glyphs reachable from the glyphs in from
+    void reach(const iftb::wr_set &from, iftb::wr_set &to);
+    /* Treats each set in sources (and the set always) as a starting point.
+       On return owner[gid] is the index of the one source that every path
+       to gid passes through, NO_SOURCE if there is no such source or
+       UNREACHED if gid can't be reached at all.
+     */
+    void dominate(const std::vector<iftb::wr_set> &sources,
+                  const iftb::wr_set &always, std::vector<uint32_t> &owner);
+    uint32_t edgeCount() { return targets.size(); }
+ private:
+    bool add_subtable_edges(std::istream &is, uint16_t type, uint32_t off);
+    bool read_coverage(std::istream &is, uint32_t off,
+                       std::vector<uint16_t> &gids);
+    uint32_t glyphCount;
+    std::vector<std::pair<uint32_t, uint32_t>> edges;
+    // Compressed adjacency: successors of gid are
+    // targets[offsets[gid]] to targets[offsets[gid+1]-1]
+    std::vector<uint32_t> offsets, targets;
+};
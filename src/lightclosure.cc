@@ -0,0 +1,111 @@
+/*
+Copyright 2023 Adobe
+All Rights Reserved.
+
+NOTICE: Adobe permits you to use, modify, and distribute this file in
+accordance with the terms of the Adobe license agreement accompanying
+it.
+*/
+
+#include <iostream>
+#include <cassert>
+
+#include "lightclosure.h"
+#include "closurecache.h"
+#include "tag.h"
+
+bool iftb::light_closure::init(iftb::wr_face &f,
+                               const std::vector<iftb::merger::glyphrec> &recs,
+                               bool is_cff, bool is_variable) {
+    wr_set tables, vss, us;
+    wr_font font;
+    hb_map_t *nmap;
+    uint32_t vs, u, g;
+    int idx = -1;
+
+    f.get_table_tags(tables);
+    if (tables.has(tag("COLR")) || tables.has(tag("MATH")))
+        return false;
+    if (is_cff && !is_variable && glyph_graph::cff_has_seac(recs))
+        return false;
+
+    face = std::make_unique<wr_face>(f);
+    glyph_count = face->get_glyph_count();
+    has_gsub = tables.has(tag("GSUB"));
+
+    components = std::make_unique<glyph_graph>(glyph_count);
+    if (!is_cff && !components->add_glyf_edges(recs))
+        return false;
+    components->finalize();
+
+    nmap = hb_map_create();
+    hb_face_collect_nominal_glyph_mapping(face->f, nmap, NULL);
+    while (hb_map_next(nmap, &idx, &u, &g))
+        nominal.emplace(u, g);
+    hb_map_destroy(nmap);
+
+    font.create(*face);
+    hb_face_collect_variation_selectors(face->f, vss.s);
+    vs = HB_SET_VALUE_INVALID;
+    while (vss.next(vs)) {
+        us.clear();
+        hb_face_collect_variation_unicodes(face->f, vs, us.s);
+        u = HB_SET_VALUE_INVALID;
+        while (us.next(u)) {
+            auto i = nominal.find(u);
+            if (hb_font_get_variation_glyph(font.f, u, vs, &g) &&
+                (i == nominal.end() || i->second != g))
+                variants.emplace(u, g);
+        }
+    }
+    return true;
+}
+
+/* Follows the order of the subset plan: glyphs mapped from the unicodes,
+   the GSUB closure of the lookups under the requested features, and then
+   the composite glyph components of everything so far.
+ */
+void iftb::light_closure::closure(iftb::wr_subset_input &in,
+                                  iftb::wr_set &gids) {
+    wr_set mapped, lookups;
+    std::vector<hb_tag_t> features;
+    uint32_t u = HB_SET_VALUE_INVALID;
+
+    hb_set_set(mapped.s, in.gid_set());
+    mapped.add(0);
+    hb_set_t *unicodes = in.unicode_set();
+    while (hb_set_next(unicodes, &u)) {
+        auto i = nominal.find(u);
+        if (i != nominal.end())
+            mapped.add(i->second);
+        auto [start, end] = variants.equal_range(u);
+        for (auto it = start; it != end; ++it)
+            mapped.add(it->second);
+    }
+
+    if (has_gsub) {
+        hb_set_t *fs = in.set(HB_SUBSET_SETS_LAYOUT_FEATURE_TAG);
+        u = HB_SET_VALUE_INVALID;
+        while (hb_set_next(fs, &u))
+            features.push_back(u);
+        features.push_back(HB_TAG_NONE);
+        hb_ot_layout_collect_lookups(face->f, HB_OT_TAG_GSUB, NULL, NULL,
+                                     features.data(), lookups.s);
+        hb_ot_layout_lookups_substitute_closure(face->f, lookups.s, mapped.s);
+    }
+    if (glyph_count > 0)
+        mapped.del_range(glyph_count, HB_SET_VALUE_INVALID - 1);
+
+    components->reach(mapped, gids);
+
+#ifndef NDEBUG
+    wr_set check;
+    closure_cache::plan_closure(*face, in, check);
+    if (!(check == gids)) {
+        std::cerr << "Error: Light glyph closure differs from subset plan ";
+        std::cerr << "closure (" << gids.size() << " vs " << check.size();
+        std::cerr << " glyphs)" << std::endl;
+        assert(false);
+    }
+#endif
+}
@@ -0,0 +1,50 @@
+/*
+Copyright 2023 Adobe
+All Rights Reserved.
+
+NOTICE: Adobe permits you to use, modify, and distribute this file in
+accordance with the terms of the Adobe license agreement accompanying
+it.
+*/
+
+/* The iftb::light_closure object calculates the same glyph closure as a
+   harfbuzz subset plan (cmap, GSUB and glyf composite components) without
+   building the table plans the encoder doesn't use. Builds without NDEBUG
+   check each result against the subset plan. It is only included in the
+   encoder.
+ */
+
+#include <memory>
+#include <unordered_map>
+
+#include "glyphgraph.h"
+#include "merger.h"
+#include "wrappers.h"
+
+#pragma once
+
+namespace iftb {
+    class light_closure;
+}
+
+class iftb::light_closure {
+ public:
+    /* Returns false if the face has closure sources (COLR, MATH, CFF seac
+       accents) that are only handled by the subset plan. recs are the
+       glyf or CFF charstring records of face.
+     */
+    bool init(iftb::wr_face &f,
+              const std::vector<iftb::merger::glyphrec> &recs,
+              bool is_cff, bool is_variable);
+    // Sets gids to the closure of the input unicodes, gids and features.
+    // Safe to call from multiple threads.
+    void closure(iftb::wr_subset_input &in, iftb::wr_set &gids);
+ private:
+    std::unique_ptr<iftb::wr_face> face;
+    uint32_t glyph_count = 0;
+    bool has_gsub = false;
+    std::unordered_map<uint32_t, uint32_t> nominal;
+    // Glyphs mapped from codepoints by cmap format 14 variation sequences
+    std::unordered_multimap<uint32_t, uint32_t> variants;
+    std::unique_ptr<iftb::glyph_graph> components;
+};
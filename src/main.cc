@@ -12,11 +12,17 @@ it.
 #include <fstream>
 #include <filesystem>
 #include <stdexcept>
+#include <thread>
+#include <algorithm>
+#include <map>
+#include <chrono>
+#include <sys/resource.h>
 
 #include "argparse.hpp"
 #include "woff2/encode.h"
 
 #include "sanitize.h"
+#include "batch.h"
 #include "config.h"
 #include "chunker.h"
 #include "client.h"
@@ -48,45 +54,115 @@ std::string loadPathAsString(std::filesystem::path &fpath,
     return s;
 }
 
-void addChunks(iftb::client &cl, std::vector<uint16_t> &chunks,
-               bool useRangeFile = false) {
-    std::string cs;
-    if (useRangeFile) {
-        std::filesystem::path rpath = cl.getRangeFileURI();
-        std::ifstream rs(rpath, std::ios::binary);
-        for (auto cidx: chunks) {
-            if (cidx >= cl.getChunkCount()) {
-                std::cerr << cidx << " is greater than Chunk Count ";
-                std::cerr << cl.getChunkCount() << std::endl;
-                continue;
-            }
+// Reads the compressed chunks, from their files or the range file
+std::map<uint16_t, std::string> readChunks(iftb::client &cl,
+                                           std::vector<uint16_t> &chunks,
+                                           bool useRangeFile = false) {
+    std::map<uint16_t, std::string> zchunks;
+    std::ifstream rs;
+    if (useRangeFile)
+        rs.open(std::filesystem::path(cl.getRangeFileURI()), std::ios::binary);
+    for (auto cidx: chunks) {
+        if (cidx >= cl.getChunkCount()) {
+            std::cerr << cidx << " is greater than Chunk Count ";
+            std::cerr << cl.getChunkCount() << std::endl;
+            continue;
+        }
+        std::string &cs = zchunks[cidx];
+        if (useRangeFile) {
             auto [cstart, cend] = cl.getChunkRange(cidx);
-            uint32_t clen = cend - cstart;
-            cs.resize(clen);
+            cs.resize(cend - cstart);
             rs.seekg(cstart);
-            rs.read(cs.data(), clen);
-            if (!cl.addChunk(cidx, cs, true)) {
-                std::cerr << "Problem merging chunk " << cidx;
-                std::cerr << ", stopping." << std::endl;
+            if (!rs.read(cs.data(), cs.size())) {
+                std::cerr << "Problem reading chunk " << cidx;
+                std::cerr << " from range file, stopping." << std::endl;
                 std::exit(1);
             }
-        }
-    } else {
-        for (auto cidx: chunks) {
-            if (cidx >= cl.getChunkCount()) {
-                std::cerr << cidx << " is greater than Chunk Count ";
-                std::cerr << cl.getChunkCount() << std::endl;
-                continue;
-            }
+        } else {
             std::filesystem::path cp = cl.getChunkURI(cidx);
             cs = loadPathAsString(cp, false);
-            if (!cl.addChunk(cidx, cs, true)) {
-                std::cerr << "Problem merging chunk " << cidx;
-                std::cerr << ", stopping." << std::endl;
-                std::exit(1);
-            }
         }
     }
+    return zchunks;
+}
+
+/* Reads the compressed chunks first and then has the client decode them
+   as one batch on jobs threads.
+ */
+void addChunks(iftb::client &cl, std::vector<uint16_t> &chunks,
+               bool useRangeFile = false, uint16_t jobs = 0) {
+    if (!cl.addChunks(readChunks(cl, chunks, useRangeFile), true, jobs)) {
+        std::cerr << "Problem merging chunks, stopping." << std::endl;
+        std::exit(1);
+    }
+}
+
+void reportMerge(iftb::client &cl) {
+    auto &ms = cl.lastMergeStats();
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+#ifdef __APPLE__
+    long maxrss = ru.ru_maxrss / 1024;
+#else
+    long maxrss = ru.ru_maxrss;
+#endif
+    std::cerr << "Merged font length " << ms.oldLength << " -> ";
+    std::cerr << ms.newLength << (ms.inPlace ? " (in place)" : "");
+    std::cerr << ", peak font buffers " << ms.peakBufferBytes;
+    std::cerr << " bytes, chunk data " << ms.chunkBytes << " bytes";
+    std::cerr << ", max RSS " << maxrss << " KB" << std::endl;
+}
+
+/* Times loading the font and then decoding and merging the chunks, each
+   iteration with a new client. The files are read beforehand, so only
+   client work is timed.
+ */
+void benchMerge(std::string &fs, std::vector<uint16_t> &chunks,
+                bool useRangeFile, bool asIFTB, uint16_t jobs,
+                uint32_t iterations) {
+    std::map<uint16_t, std::string> zchunks;
+    {
+        iftb::client cl;
+        if (!cl.loadFont(fs))
+            std::exit(1);
+        zchunks = readChunks(cl, chunks, useRangeFile);
+    }
+    auto ms = [](auto d) {
+        return std::chrono::duration<double, std::milli>(d).count();
+    };
+    std::vector<double> load, add, merge;
+    uint32_t length = 0;
+    for (uint32_t i = 0; i < iterations; i++) {
+        iftb::client cl;
+        auto t0 = std::chrono::steady_clock::now();
+        if (!cl.loadFont(fs))
+            std::exit(1);
+        auto t1 = std::chrono::steady_clock::now();
+        if (!cl.addChunks(zchunks, true, jobs)) {
+            std::cerr << "Problem adding chunks, stopping." << std::endl;
+            std::exit(1);
+        }
+        auto t2 = std::chrono::steady_clock::now();
+        if (!cl.merge(asIFTB)) {
+            std::cerr << "Problem merging, stopping" << std::endl;
+            std::exit(1);
+        }
+        auto t3 = std::chrono::steady_clock::now();
+        length = cl.getFontAsString().size();
+        load.push_back(ms(t1 - t0));
+        add.push_back(ms(t2 - t1));
+        merge.push_back(ms(t3 - t2));
+    }
+    auto report = [](const char *name, std::vector<double> &v) {
+        std::sort(v.begin(), v.end());
+        std::cout << name << ": best " << v.front() << " ms, median "
+                  << v[v.size() / 2] << " ms" << std::endl;
+    };
+    std::cout << zchunks.size() << " chunks, " << iterations
+              << " iterations, merged font length " << length << std::endl;
+    report("load", load);
+    report("decode", add);
+    report("merge", merge);
 }
 
 void convertToWOFF2(std::string &s) {
@@ -128,6 +204,7 @@ int dispatch(argparse::ArgumentParser &program, iftb::config &conf) {
         iftb::chunker ck(conf);
 
         conf.load(program.get<std::string>("-c"), !program.is_used("-c"));
+        conf.setJobs(process.get<uint16_t>("-j"));
 
         if (process.is_used("-o")) {
             prefix = process.get<std::string>("-o");
@@ -140,6 +217,19 @@ int dispatch(argparse::ArgumentParser &program, iftb::config &conf) {
 
         fs = loadPathAsString(fpath);
         r = ck.process(fs);
+    } else if (program.is_subcommand_used("batch")) {
+        auto batch = program.at<argparse::ArgumentParser>("batch");
+        std::filesystem::path mpath = batch.get<std::string>("manifest");
+        uint16_t parallel;
+
+        conf.setJobs(batch.get<uint16_t>("-j"));
+        if (batch.is_used("-p"))
+            parallel = batch.get<uint16_t>("-p");
+        else
+            parallel = std::max(1u, std::thread::hardware_concurrency() /
+                                    conf.jobs());
+        r = iftb::batch(mpath, program.get<std::string>("-c"), conf,
+                        parallel) ? 1 : 0;
     } else if (program.is_subcommand_used("dump-chunks")) {
         auto dumpchunks = program.at<argparse::ArgumentParser>("dump-chunks");
         auto chunks = dumpchunks.get<std::vector<uint16_t>>("indexes");
@@ -148,12 +238,12 @@ int dispatch(argparse::ArgumentParser &program, iftb::config &conf) {
 
         iftb::sfnt sft(fs);
         sft.read();
-        simplestream ss;
-        if (!sft.getTableStream(ss, T_IFTB))
+        spanreader sr;
+        if (!sft.getTableReader(sr, T_IFTB))
             throw std::runtime_error("No IFTB table in font file");
 
         iftb::table_IFTB tiftb;
-        tiftb.decompile(ss);
+        tiftb.decompile(sr);
         std::filesystem::current_path(fpath.parent_path());
         std::stringstream css;
         if (dumpchunks["-r"] == true) {
@@ -170,7 +260,8 @@ int dispatch(argparse::ArgumentParser &program, iftb::config &conf) {
                 std::string cfz(clen, 0);
                 rs.seekg(cstart);
                 rs.read(cfz.data(), clen);
-                css.str(iftb::decodeChunk(cfz.data(), cfz.size()));
+                css.str(iftb::decodeChunk(cfz.data(), cfz.size(),
+                                          tiftb.getDictionary()));
                 std::cerr << std::endl << cidx << std::endl;
                 iftb::dumpChunk(std::cerr, css);
             }
@@ -182,7 +273,8 @@ int dispatch(argparse::ArgumentParser &program, iftb::config &conf) {
                     continue;
                 }
                 std::filesystem::path cp = tiftb.getChunkURI(cidx);
-                std::string cfs = loadPathAsString(cp);
+                std::string cfs = loadPathAsString(cp, false);
+                iftb::decodeBuffer(NULL, 0, cfs, 0.0, tiftb.getDictionary());
                 css.str(cfs);
                 std::cerr << std::endl << cidx << ": " << cp << std::endl;
                 iftb::dumpChunk(std::cerr, css);
@@ -201,7 +293,7 @@ int dispatch(argparse::ArgumentParser &program, iftb::config &conf) {
         std::filesystem::path ocwd = std::filesystem::current_path();
         std::filesystem::current_path(fpath.parent_path());
 
-        addChunks(cl, chunks, merge["-r"] == true);
+        addChunks(cl, chunks, merge["-r"] == true, merge.get<uint16_t>("-j"));
 
         if (!cl.canMerge()) {
             std::cerr << "Client reports it can't merge, stopping";
@@ -212,6 +304,8 @@ int dispatch(argparse::ArgumentParser &program, iftb::config &conf) {
             std::cerr << "Problem merging, stopping" << std::endl;
             std::exit(1);
         }
+        if (conf.verbosity())
+            reportMerge(cl);
         std::filesystem::current_path(ocwd);
         std::string &nfs = cl.getFontAsString();
         if (merge["-w"] == true)
@@ -249,11 +343,21 @@ int dispatch(argparse::ArgumentParser &program, iftb::config &conf) {
         cl.setPending(unilist, features);
         std::vector<uint16_t> chunks;
         cl.getPendingChunkList(chunks);
+        uint32_t expectLength;
+        size_t expectChunkBytes;
+        if (cl.getPendingSizes(expectLength, expectChunkBytes)) {
+            cl.reservePending();
+            if (conf.verbosity())
+                std::cerr << "Expecting merged font length at most "
+                          << expectLength << ", chunk data "
+                          << expectChunkBytes << " bytes" << std::endl;
+        }
 
         std::filesystem::path ocwd = std::filesystem::current_path();
         std::filesystem::current_path(fpath.parent_path());
 
-        addChunks(cl, chunks, preload["-r"] == true);
+        addChunks(cl, chunks, preload["-r"] == true,
+                  preload.get<uint16_t>("-j"));
 
         if (!cl.canMerge()) {
             std::cerr << "Client reports it can't merge, stopping";
@@ -264,6 +368,8 @@ int dispatch(argparse::ArgumentParser &program, iftb::config &conf) {
             std::cerr << "Problem merging, stopping" << std::endl;
             std::exit(1);
         }
+        if (conf.verbosity())
+            reportMerge(cl);
         std::filesystem::current_path(ocwd);
 
         std::string &nfs = cl.getFontAsString();
@@ -289,6 +395,21 @@ int dispatch(argparse::ArgumentParser &program, iftb::config &conf) {
         os.close();
         std::cerr << "Wrote output file " << opath << std::endl;
         r = 0;
+    } else if (program.is_subcommand_used("bench")) {
+        auto bench = program.at<argparse::ArgumentParser>("bench");
+        auto chunks = bench.get<std::vector<uint16_t>>("indexes");
+        std::filesystem::path fpath = bench.get<std::string>("base_file");
+        std::string fs = loadPathAsString(fpath);
+        uint32_t iterations = bench.get<uint32_t>("-n");
+        if (iterations == 0)
+            iterations = 1;
+
+        std::filesystem::path ocwd = std::filesystem::current_path();
+        std::filesystem::current_path(fpath.parent_path());
+        benchMerge(fs, chunks, bench["-r"] == true, bench["-l"] == false,
+                   bench.get<uint16_t>("-j"), iterations);
+        std::filesystem::current_path(ocwd);
+        r = 0;
     } else if (program.is_subcommand_used("stress-test")) {
         auto stresstest = program.at<argparse::ArgumentParser>("stress-test");
         std::filesystem::path fpath = stresstest.get<std::string>("base_file");
@@ -299,6 +420,9 @@ int dispatch(argparse::ArgumentParser &program, iftb::config &conf) {
         fs[2] = 'T';
         fs[3] = 'O';
 
+        // Chunk file paths are relative to the font
+        std::filesystem::path ocwd = std::filesystem::current_path();
+        std::filesystem::current_path(fpath.parent_path());
         if (iftb::randtest(fs)) {
             std::cerr << "File passed stress tests" << std::endl;
             r = 0;
@@ -306,6 +430,7 @@ int dispatch(argparse::ArgumentParser &program, iftb::config &conf) {
             std::cerr << "File failed stress tests" << std::endl;
             r = 1;
         }
+        std::filesystem::current_path(ocwd);
     } else {
         std::cerr << "Error: No command specified" << std::endl;
         std::cerr << program;
@@ -331,6 +456,8 @@ int main(int argc, char **argv) {
            .default_value(false)
            .implicit_value(true)
            .nargs(0);
+    program.add_argument("--closure-cache")
+           .help("Directory for storing glyph closure results between runs");
     program.add_argument("--no-catch")
            .help("Don't catch exceptions (for debugging)")
            .default_value(false)
@@ -344,6 +471,26 @@ int main(int argc, char **argv) {
     process.add_argument("-o", "--output-prefix")
          .help("Filename prefix for output files "
                "(default is input path without extension plus \"_iftb\")");
+    process.add_argument("-j", "--jobs")
+         .help("Number of threads to use for glyph closure calculations")
+         .default_value((uint16_t) 1)
+         .scan<'u', uint16_t>();
+
+    argparse::ArgumentParser batch("batch");
+    batch.add_description("Process the fonts listed in a YAML manifest "
+                          "of font, config and output entries");
+    batch.add_argument("manifest")
+         .help("A YAML sequence of maps with \"font\" and optional "
+               "\"config\" and \"output\" (prefix) paths");
+    batch.add_argument("-p", "--parallel")
+         .help("Number of fonts to process at once (default is the "
+               "number of CPUs divided by --jobs)")
+         .scan<'u', uint16_t>();
+    batch.add_argument("-j", "--jobs")
+         .help("Number of threads to use for glyph closure calculations "
+               "for each font")
+         .default_value((uint16_t) 1)
+         .scan<'u', uint16_t>();
 
     argparse::ArgumentParser check("check");
     check.add_description("Verify a processed file is organized correctly");
@@ -393,6 +540,11 @@ int main(int argc, char **argv) {
          .help("Output WOFF2")
          .default_value(false)
          .implicit_value(true);
+    merge.add_argument("-j", "--jobs")
+         .help("Number of threads to use for chunk decompression "
+               "(default is the number of CPUs)")
+         .default_value((uint16_t) 0)
+         .scan<'u', uint16_t>();
 
     argparse::ArgumentParser preload("preload");
     preload.add_description("Preload the file by config tag");
@@ -414,6 +566,39 @@ int main(int argc, char **argv) {
          .help("Output WOFF2")
          .default_value(false)
          .implicit_value(true);
+    preload.add_argument("-j", "--jobs")
+         .help("Number of threads to use for chunk decompression "
+               "(default is the number of CPUs)")
+         .default_value((uint16_t) 0)
+         .scan<'u', uint16_t>();
+
+    argparse::ArgumentParser bench("bench");
+    bench.add_description("Time loading the base and merging chunks by "
+                          "index into it");
+    bench.add_argument("base_file")
+         .help("The IFTB (binned) input file");
+    bench.add_argument("indexes")
+         .help("A list of positive integer indexes")
+         .nargs(argparse::nargs_pattern::at_least_one)
+         .required()
+         .scan<'u', uint16_t>();
+    bench.add_argument("-n", "--iterations")
+         .help("Number of times to load and merge")
+         .default_value((uint32_t) 20)
+         .scan<'u', uint32_t>();
+    bench.add_argument("-r", "--by-range")
+         .help("Retrieve the chunk from the range file")
+         .default_value(false)
+         .implicit_value(true);
+    bench.add_argument("-l", "--for-loading")
+         .help("Set the sfnt version to OpenType/TrueType (instead of IFTB)")
+         .default_value(false)
+         .implicit_value(true);
+    bench.add_argument("-j", "--jobs")
+         .help("Number of threads to use for chunk decompression "
+               "(default is the number of CPUs)")
+         .default_value((uint16_t) 0)
+         .scan<'u', uint16_t>();
 
     argparse::ArgumentParser stresstest("stress-test");
     stresstest.add_description("Test binning algorithm against random "
@@ -422,11 +607,13 @@ int main(int argc, char **argv) {
               .help("The IFTB (binned) input file");
 
     program.add_subparser(process);
+    program.add_subparser(batch);
     program.add_subparser(check);
     program.add_subparser(info);
     program.add_subparser(merge);
     program.add_subparser(preload);
     program.add_subparser(dumpchunks);
+    program.add_subparser(bench);
     program.add_subparser(stresstest);
 
     try {
@@ -437,6 +624,9 @@ int main(int argc, char **argv) {
         return 1;
     }
 
+    if (program.is_used("--closure-cache"))
+        conf.setClosureCachePath(program.get<std::string>("--closure-cache"));
+
     int r = 0;
     if (program["--no-catch"] == true) {
         r = dispatch(program, conf);
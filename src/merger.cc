@@ -13,18 +13,25 @@ it.
 #include <limits>
 #include <sstream>
 
-#include <brotli/decode.h>
 #include <woff2/decode.h>
 
 #include "merger.h"
+#include "chunkdecoder.h"
 
 #include "streamhelp.h"
 #include "tag.h"
 
-bool iftb::merger::unpackChunks() {
+// Chunks kept from an earlier deferred merge are already unpacked
+bool iftb::merger::unpackChunks(const iftb::chunk_set *only) {
+    std::lock_guard<std::mutex> lk(chunkDataMutex);
     for (auto &i: chunkData) {
+        if (unpacked.find(i.first) != unpacked.end())
+            continue;
+        if (only != nullptr && !only->test(i.first))
+            continue;
         if (!chunkAddRecs(i.first, i.second))
             return false;
+        unpacked.insert(i.first);
     }
     return true;
 }
@@ -37,7 +44,7 @@ bool iftb::merger::chunkAddRecs(uint16_t idx, const std::string &cd) {
     uint8_t i8, tableCount;
     std::vector<uint16_t> gids;
     glyphrec gr;
-    std::istringstream is(cd);
+    spanreader is(cd.data(), cd.size());
     auto cdlen = cd.size();
 
     if (readObject<uint32_t>(is) != tag("IFTC"))
@@ -62,8 +69,8 @@ bool iftb::merger::chunkAddRecs(uint16_t idx, const std::string &cd) {
     readObject(is, tableCount);
     if (!(tableCount == 1 || tableCount == 2))
         return chunkError(idx, "Chunk table count must be 1 or 2");
-    for (int i = 0; i < glyphCount; i++)
-        gids.push_back(readObject<uint16_t>(is));
+    gids.resize(glyphCount);
+    is.readArray(gids.data(), glyphCount);
     readObject(is, table1);
     if (tableCount == 2)
         readObject(is, table2);
@@ -94,14 +101,14 @@ bool iftb::merger::chunkAddRecs(uint16_t idx, const std::string &cd) {
     return true;
 }
 
-uint32_t iftb::merger::calcLengthDiff(std::istream &is, uint32_t glyphCount, 
+uint32_t iftb::merger::calcLengthDiff(spanreader &is, uint32_t glyphCount, 
                                       std::map<uint16_t, glyphrec> &glyphMap) {
     uint32_t ldiff = 0;
-    uint32_t arrayOff = is.tellg();
+    uint32_t arrayOff = is.tell();
     for (auto &i: glyphMap) {
         uint16_t gid = i.first;
         uint32_t start, end;
-        is.seekg(arrayOff + 4 * gid);
+        is.seek(arrayOff + 4 * gid);
         readObject(is, start);
         readObject(is, end);
         ldiff += i.second.length - (end - start);
@@ -109,46 +116,124 @@ uint32_t iftb::merger::calcLengthDiff(std::istream &is, uint32_t glyphCount,
     return ldiff;
 }
 
-bool iftb::merger::copyGlyphData(std::iostream &s, uint32_t glyphCount,
+static inline uint32_t offsetAt(const char *offsets, uint32_t i) {
+    const uint8_t *p = (const uint8_t *) offsets + i * 4;
+    return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 |
+           (uint32_t) p[2] << 8 | p[3];
+}
+
+static inline uint32_t rotr(uint32_t v, uint32_t r) {
+    return v >> r | v << ((32 - r) & 31);
+}
+
+// The share of a table checksum of the bytes of run when they start at pos
+static inline uint32_t runChecksum(const char *run, uint32_t length,
+                                   uint32_t pos) {
+    iftb::checksum_lanes lanes;
+    lanes.add(run, length);
+    return lanes.at(pos);
+}
+
+/* Adds delta to the 32-bit big-endian entries first through last and
+   returns the change to the checksum of a table in which the array starts
+   at pos. An entry at an unaligned position adds to the checksum rotated
+   by its alignment. Written as a flat byte loop so that it vectorizes.
+ */
+static uint32_t addToOffsets(char *offsets, uint32_t first, uint32_t last,
+                             uint32_t delta, uint32_t pos) {
+    uint8_t *p = (uint8_t *) offsets + first * 4;
+    uint32_t rot = 8 * ((pos + first * 4) & 3), sum = 0;
+    if (delta == 0)
+        return 0;
+    for (uint32_t i = first; i <= last; i++, p += 4) {
+        uint32_t v = (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 |
+                     (uint32_t) p[2] << 8 | p[3];
+        sum += rotr(v + delta, rot) - rotr(v, rot);
+        v += delta;
+        p[0] = v >> 24;
+        p[1] = v >> 16;
+        p[2] = v >> 8;
+        p[3] = v;
+    }
+    return sum;
+}
+
+/* Works back from the last glyph so that data only moves toward the end
+   of the buffer. Between each pair of chunk glyphs the untouched glyphs
+   are moved with one memmove and their offsets adjusted by the same
+   delta, so the cost is in the number of chunk glyphs rather than the
+   number of glyphs.
+
+   The checksum changes follow the same runs. A run moved by a multiple of
+   four bytes keeps its share of the checksum, so only runs moved by other
+   amounts and the replaced glyphs themselves are summed.
+ */
+bool iftb::merger::copyGlyphData(char *offsets, uint32_t offsetsLength,
+                                 uint32_t glyphCount,
                                  char *nbase, char *cbase, uint32_t ldiff,
                                  std::map<uint16_t, glyphrec> &glyphMap,
-                                 uint32_t basediff) {
-    uint32_t off, nextOff, clen;
-    s.seekg(glyphCount * 4);
-    readObject(s, nextOff);
-    char *ctrailing = cbase + nextOff, *ntrailing = nbase + nextOff + ldiff;
-    // XXX Could reduce the number of memmove calls (but not the amount of
-    // data copied) by grouping the consecutive copies from ctrailing
-    for (int64_t i = glyphCount-1; i >= 0; i--) {
-        s.seekp((i + 1) * 4);
-        writeObject(s, (uint32_t) (ntrailing - nbase));
-        s.seekg(i * 4);
-        readObject(s, off);
-        ctrailing -= nextOff - off;
-        auto j = glyphMap.find(i);
-        if (j != glyphMap.end()) {
-            ntrailing -= j->second.length;
-            memmove(ntrailing, j->second.offset, j->second.length);
-        } else {
-            ntrailing -= nextOff - off;
-            if (ntrailing != ctrailing)
-                memmove(ntrailing, ctrailing, nextOff - off);
+                                 uint32_t basediff, sum_delta *sums) {
+    uint32_t delta = ldiff, hi = glyphCount, start, end;
+    uint32_t offSum = 0, dataSum = 0;
+    uint32_t offPos = sums ? sums->offPos : 0;
+    uint32_t dataPos = sums ? sums->dataPos : 0;
+    if (offsetsLength < (glyphCount + 1) * 4) {
+        std::cerr << "Glyph offset array too short merging chunks";
+        std::cerr << std::endl;
+        return false;
+    }
+    for (auto i = glyphMap.rbegin(); i != glyphMap.rend(); i++) {
+        uint32_t gid = i->first;
+        if (gid >= glyphCount)
+            continue;
+        start = offsetAt(offsets, gid + 1);
+        end = offsetAt(offsets, hi);
+        if (end < start) {
+            std::cerr << "Glyph offsets out of order merging chunks";
+            std::cerr << std::endl;
+            return false;
         }
-        nextOff = off;
+        uint32_t clen = start - offsetAt(offsets, gid);
+        if (sums) {
+            // Read the replaced glyph before anything is moved over it
+            dataSum -= runChecksum(cbase + start - clen, clen,
+                                   dataPos + start - clen);
+            if ((delta & 3) != 0) {
+                iftb::checksum_lanes lanes;
+                lanes.add(cbase + start, end - start);
+                dataSum += lanes.at(dataPos + start + delta) -
+                           lanes.at(dataPos + start);
+            }
+        }
+        if (delta != 0 || nbase != cbase)
+            memmove(nbase + start + delta, cbase + start, end - start);
+        offSum += addToOffsets(offsets, gid + 1, hi, delta, offPos);
+        delta -= i->second.length - clen;
+        memmove(nbase + start - clen + delta, i->second.offset,
+                i->second.length);
+        if (sums)
+            dataSum += runChecksum(i->second.offset, i->second.length,
+                                   dataPos + start - clen + delta);
+        hi = gid;
     }
-    if (ctrailing - cbase != basediff || ntrailing - nbase != basediff) {
+    start = offsetAt(offsets, 0);
+    end = offsetAt(offsets, hi);
+    if (start != basediff || delta != 0 || end < start) {
         std::cerr << "Logic error merging chunks" << std::endl;
         return false;
     }
-    if (s.fail()) {
-        std::cerr << "Stream failure merging chunks" << std::endl;
-        return false;
+    if (nbase != cbase)
+        memmove(nbase + start, cbase + start, end - start);
+    if (sums) {
+        sums->offSum += offSum;
+        sums->dataSum += dataSum;
     }
     return true;
 }
 
 uint32_t iftb::merger::calcLayout(iftb::sfnt &sf, uint32_t numg, uint32_t cso) {
     uint32_t ldiff;
+    spanreader sr;
 
     charStringOff = cso;
     glyphCount = numg;
@@ -178,14 +263,14 @@ uint32_t iftb::merger::calcLayout(iftb::sfnt &sf, uint32_t numg, uint32_t cso) {
         }
     }
     if (t1tag) {
-        sf.getTableStream(ss, t1tag);
+        sf.getTableReader(sr, t1tag);
         if (has_cff) {
-            ss.seekg(charStringOff + (is_cff2 ? 5 : 3));
+            sr.seek(charStringOff + (is_cff2 ? 5 : 3));
         } else {  // gvar
-            ss.seekg(16);
-            readObject(ss, gvarDataOff);
+            sr.seek(16);
+            readObject(sr, gvarDataOff);
         }
-        ldiff = calcLengthDiff(ss, glyphCount, has_cff ? glyphMap1 : glyphMap2);
+        ldiff = calcLengthDiff(sr, glyphCount, has_cff ? glyphMap1 : glyphMap2);
         t1nlen = t1clen + ldiff;
     }
     if (!has_cff) {
@@ -194,9 +279,8 @@ uint32_t iftb::merger::calcLayout(iftb::sfnt &sf, uint32_t numg, uint32_t cso) {
         else
             glyfnoff = glyfcoff;
 
-        sf.getTableStream(ss, T_LOCA);
-        ss.seekg(0);
-        ldiff = calcLengthDiff(ss, glyphCount, glyphMap1);
+        sf.getTableReader(sr, T_LOCA);
+        ldiff = calcLengthDiff(sr, glyphCount, glyphMap1);
         glyfnlen = glyfclen + ldiff;
         locanoff = ((glyfnoff + glyfnlen + 3) / 4) * 4;
     }
@@ -207,7 +291,8 @@ uint32_t iftb::merger::calcLayout(iftb::sfnt &sf, uint32_t numg, uint32_t cso) {
     return fontend;
 }
 
-bool iftb::merger::merge(iftb::sfnt &sf, char *oldbuf, char *newbuf) {
+bool iftb::merger::merge(iftb::sfnt &sf, char *oldbuf, char *newbuf,
+                         bool updateChecksums) {
     uint32_t cffOffOff = charStringOff + (is_cff2 ? 5 : 3);
     if (oldbuf != newbuf) {
         if (has_cff)
@@ -221,37 +306,48 @@ bool iftb::merger::merge(iftb::sfnt &sf, char *oldbuf, char *newbuf) {
         sf.setBuffer(oldbuf, fontend);
     }
     if (!has_cff) {
+        sum_delta sums;
         memmove(newbuf + locanoff, oldbuf + locacoff, localen);
-        ss.rdbuf()->pubsetbuf(newbuf + locanoff, localen);
-        if (!copyGlyphData(ss, glyphCount, newbuf + glyfnoff,
+        if (!copyGlyphData(newbuf + locanoff, localen, glyphCount,
+                           newbuf + glyfnoff,
                            oldbuf + glyfcoff, glyfnlen - glyfclen,
-                           glyphMap1, 0))
+                           glyphMap1, 0, updateChecksums ? &sums : nullptr))
             return false;
         for (uint32_t i = locanoff + localen; i < fontend; i++)
             *(newbuf + i) = 0;
         for (uint32_t i = glyfnoff + glyfnlen; i < locanoff; i++)
             *(newbuf + i) = 0;
-        sf.adjustTable(T_LOCA, locanoff, localen, true);
-        sf.adjustTable(T_GLYF, glyfnoff, glyfnlen, true);
+        sf.adjustTable(T_LOCA, locanoff, localen, false);
+        sf.adjustTable(T_GLYF, glyfnoff, glyfnlen, false);
+        if (updateChecksums) {
+            sf.adjustChecksum(T_LOCA, sums.offSum);
+            sf.adjustChecksum(T_GLYF, sums.dataSum);
+        }
     }
     if (t1tag) {
-        uint32_t dataoff;
+        uint32_t dataoff, arrayoff;
+        sum_delta sums;
         for (uint32_t i = t1off + t1nlen; i < ((has_cff) ? fontend : glyfnoff);
              i++)
             *(newbuf + i) = 0;
         if (has_cff) {
-            ss.rdbuf()->pubsetbuf(newbuf + t1off + cffOffOff,
-                                  (glyphCount + 1) * 4);
+            arrayoff = t1off + cffOffOff;
             dataoff = t1off + cffOffOff + (glyphCount + 1) * 4 - 1;
         } else {  // gvar
-            ss.rdbuf()->pubsetbuf(newbuf + t1off + 20, (glyphCount + 1) * 4);
+            arrayoff = t1off + 20;
             dataoff = t1off + gvarDataOff;
         }
-        if (!copyGlyphData(ss, glyphCount, newbuf + dataoff,
+        sums.offPos = arrayoff - t1off;
+        sums.dataPos = dataoff - t1off;
+        if (!copyGlyphData(newbuf + arrayoff, (glyphCount + 1) * 4,
+                           glyphCount, newbuf + dataoff,
                            oldbuf + dataoff, t1nlen - t1clen,
-                           has_cff ? glyphMap1 : glyphMap2, has_cff ? 1 : 0))
+                           has_cff ? glyphMap1 : glyphMap2, has_cff ? 1 : 0,
+                           updateChecksums ? &sums : nullptr))
             return false;
-        sf.adjustTable(t1tag, t1off, t1nlen, true);
+        sf.adjustTable(t1tag, t1off, t1nlen, false);
+        if (updateChecksums)
+            sf.adjustChecksum(t1tag, sums.offSum + sums.dataSum);
     }
     return true;
 }
@@ -328,29 +424,14 @@ void iftb::dumpChunk(std::ostream &os, std::istream &is) {
     }
 }
  
-std::string iftb::decodeChunk(char *buf, size_t length) {
-    uint32_t l;
-
-    simpleistream sis;
-    sis.rdbuf()->pubsetbuf(buf, length);
-    sis.seekg(28);  // length offset
-    readObject(sis, l);
-
-    std::string r(l, 0);
-    memcpy(r.data(), buf, 32);
-    size_t decoded_size = l - 32;
-    auto ok = BrotliDecoderDecompress(length - 32, (uint8_t *) buf + 32,
-                                      &decoded_size,
-                                      (uint8_t *) r.data() + 32);
-    if (ok != BROTLI_DECODER_RESULT_SUCCESS && decoded_size == l - 32) {
-        std::cerr << "Error: Could not decompress IFTZ chunk";
-        r.clear();
-    } else if (decoded_size != l - 32) {
-        std::cerr << "Error: Wrong length encoded in chunk";
-        r.clear();
-    }
+std::string iftb::decodeChunk(char *buf, size_t length,
+                              const iftb::chunk_dictionary *dict) {
+    std::string r;
+    iftb::decoder_pool pool;
+    iftb::chunk_decoder d(pool, r, dict);
 
-    r[3] = 'C';
+    d.add(buf, length);
+    d.finish();
     return r;
 }
 
@@ -361,7 +442,8 @@ std::string iftb::decodeChunk(char *buf, size_t length) {
    only be changed if it needs to be decoded (decompressed)
  */
 uint32_t iftb::decodeBuffer(char *buf, uint32_t length, std::string &s,
-                           float reserveExtra) {
+                           float reserveExtra,
+                           const iftb::chunk_dictionary *dict) {
     bool is_woff2 = false, is_compressed_chunk = false;
     bool in_string = (buf == NULL);
     uint32_t tg; 
@@ -397,7 +479,7 @@ uint32_t iftb::decodeBuffer(char *buf, uint32_t length, std::string &s,
             tg = 0;
         }
     } else if (is_compressed_chunk) {
-        std::string t = iftb::decodeChunk(buf, length);
+        std::string t = iftb::decodeChunk(buf, length, dict);
         if (t.size() > 4) {
             s.swap(t);
             t.clear();
@@ -16,6 +16,8 @@ it.
 #include <filesystem>
 #include <cassert>
 #include <map>
+#include <set>
+#include <mutex>
 
 #include "table_IFTB.h"
 #include "sfnt.h"
@@ -25,9 +27,11 @@ it.
 namespace iftb {
     class merger;
     void dumpChunk(std::ostream &os, std::istream &is);
-    std::string decodeChunk(char *buf, size_t length);
+    std::string decodeChunk(char *buf, size_t length,
+                            const iftb::chunk_dictionary *dict = nullptr);
     uint32_t decodeBuffer(char *buf, uint32_t length, std::string &s,
-                          float reserveExtra = 0.0);
+                          float reserveExtra = 0.0,
+                          const iftb::chunk_dictionary *dict = nullptr);
 }
 
 class iftb::merger {
@@ -46,17 +50,29 @@ public:
             assert(table1 == t1 && table2 == t2);
         }
     }
+    /* The map of chunk data is locked, so the accessors, unpackChunks()
+       and reset() can be called while other threads add chunks. The
+       bytes of a chunk still being decoded must not be unpacked.
+     */
     std::string &stringForChunk(uint16_t idx) {
+        std::lock_guard<std::mutex> lk(chunkDataMutex);
         auto i = chunkData.emplace(idx, "");
         return i.first->second;
     }
     bool chunkAddRecs(uint16_t idx, const std::string &s);
-    bool unpackChunks();
+    // Unpacks every chunk added, or only those in the set
+    bool unpackChunks(const iftb::chunk_set *only = nullptr);
+    // Chunks that were not unpacked (and may still be arriving) are kept
     void reset() {
         table1 = table2 = 0;
         glyphMap1.clear();
         glyphMap2.clear();
-        chunkData.clear();
+        {
+            std::lock_guard<std::mutex> lk(chunkDataMutex);
+            for (auto i: unpacked)
+                chunkData.erase(i);
+        }
+        unpacked.clear();
         has_cff = is_cff2 = false;
         glyphCount = charStringOff = gvarDataOff = 0;
         t1tag = t1off = t1clen = t1nlen = 0;
@@ -70,16 +86,54 @@ public:
         id[3] = i[3];
     }
     bool hasChunk(uint16_t idx) {
+        std::lock_guard<std::mutex> lk(chunkDataMutex);
         return chunkData.find(idx) != chunkData.end();
     }
-    uint32_t calcLengthDiff(std::istream &is, uint32_t glyphCount,
+    bool isUnpacked(uint16_t idx) {
+        return unpacked.find(idx) != unpacked.end();
+    }
+    void dropChunk(uint16_t idx) {
+        assert(!isUnpacked(idx));
+        std::lock_guard<std::mutex> lk(chunkDataMutex);
+        chunkData.erase(idx);
+    }
+    size_t chunkBytes() {
+        std::lock_guard<std::mutex> lk(chunkDataMutex);
+        size_t r = 0;
+        for (auto &i: chunkData)
+            r += i.second.size();
+        return r;
+    }
+    size_t chunkBytes(uint16_t idx) {
+        std::lock_guard<std::mutex> lk(chunkDataMutex);
+        auto i = chunkData.find(idx);
+        return i != chunkData.end() ? i->second.size() : 0;
+    }
+    uint32_t calcLengthDiff(spanreader &is, uint32_t glyphCount,
                             std::map<uint16_t, glyphrec> &glyphMap);
-    bool copyGlyphData(std::iostream &is, uint32_t glyphCount,
+    /* Accumulates the changes copyGlyphData makes to the checksums of the
+       tables holding the offset array and the glyph data (which may be
+       the same table). offPos and dataPos are where the array and the data
+       start within those tables.
+     */
+    struct sum_delta {
+        uint32_t offPos {0}, dataPos {0};
+        uint32_t offSum {0}, dataSum {0};
+    };
+    // offsets is the (glyphCount + 1) entry 32-bit offset array, rewritten
+    // in place
+    bool copyGlyphData(char *offsets, uint32_t offsetsLength,
+                       uint32_t glyphCount,
                        char *nbase, char *cbase, uint32_t ldiff,
                        std::map<uint16_t, glyphrec> &glyphMap,
-                       uint32_t basediff);
+                       uint32_t basediff, sum_delta *sums = nullptr);
     uint32_t calcLayout(iftb::sfnt &sf, uint32_t numg, uint32_t cso);
-    bool merge(iftb::sfnt &sf, char *oldbuf, char *newbuf);
+    /* With updateChecksums the moved tables' checksums are updated from
+       their previous values, which must be correct. Otherwise they are
+       left stale.
+     */
+    bool merge(iftb::sfnt &sf, char *oldbuf, char *newbuf,
+               bool updateChecksums = true);
 private:
     bool chunkError(uint16_t cidx, const char *m) {
         std::cerr << "Chunk " << cidx << " error: " << m << std::endl;
@@ -88,7 +142,8 @@ private:
     uint32_t table1 {0}, table2 {0}, id[4] {0,0,0,0};
     std::map<uint16_t, glyphrec> glyphMap1, glyphMap2;
     std::map<uint16_t, std::string> chunkData;
-    simplestream ss;
+    std::mutex chunkDataMutex;
+    std::set<uint16_t> unpacked;
 
     // These bridge between calcLayout() and merge()
     bool has_cff {false}, is_cff2 {false};
@@ -8,11 +8,15 @@ it.
 */
 
 #include <iostream>
+#include <fstream>
+#include <sstream>
 #include <random>
 #include <functional>
 
 #include "client.h"
+#include "sfnt.h"
 #include "wrappers.h"
+#include "closurecache.h"
 
 static uint16_t randtt() {
     static auto gen = std::bind(std::uniform_int_distribution<>(0, 9999),
@@ -37,14 +41,12 @@ bool iftb::randtest(std::string &input_string, uint32_t iterations) {
     inface.create(inblob);
 
     iftb::client cl;
-    if (!cl.loadFont(input_string, true))
+    if (!cl.loadFont(input_string))
         return false;
 
     gid_sets.resize(cl.getChunkCount());
-    for (int i = 0; i < cl.tiftb.gidMap.size(); i++) {
-        auto q = cl.tiftb.gidMap[i];
-        gid_sets[cl.tiftb.gidMap[i]].add(i);
-    }
+    for (uint32_t i = 0; i < cl.tiftb.getGlyphCount(); i++)
+        gid_sets[cl.tiftb.getGIDChunk(i)].add(i);
 
     // Read in the feature tags
     {
@@ -97,12 +99,11 @@ bool iftb::randtest(std::string &input_string, uint32_t iterations) {
                 some_features.push_back(u32);
             }
 
-        // Get transitive gid substitution closure for all points and features
-        hb_subset_plan_t *plan = hb_subset_plan_create_or_fail(proface.f, input.i);
-        hb_map_t *map = hb_subset_plan_old_to_new_glyph_mapping(plan);
-        some_gids_hb.clear();
-        hb_map_keys(map, some_gids_hb.s);
-        hb_subset_plan_destroy(plan);
+        /* Get transitive gid substitution closure for all points and
+           features, never from the closure cache the encoder filled, so
+           that a bad entry can't confirm itself
+         */
+        closure_cache::plan_closure(proface, input, some_gids_hb);
 
         cl.setPending(some_codepoints, some_features);
         cl.getPendingChunkList(pending_chunks);
@@ -117,10 +118,66 @@ bool iftb::randtest(std::string &input_string, uint32_t iterations) {
             u32 = -1;
             std::cerr << "GIDs: ";
             while (some_gids_hb.next(u32))
-                std::cerr << u32 << " (" << cl.tiftb.gidMap[u32] << "), ";
+                std::cerr << u32 << " (" << cl.tiftb.getGIDChunk(u32) << "), ";
             std::cerr << std::endl;
             assert(false);
         }
     }
+    /* Merge random sets of chunks into the font until it has all of
+       them, alternately in place and into a new buffer. The merger
+       updates the table checksums incrementally, so every checksum is
+       recalculated and compared after each merge.
+     */
+    uint32_t inPlace = 0, moved = 0;
+    std::vector<uint16_t> missing, chunks;
+    for (int session = 0; session < 4; session++) {
+        iftb::client mc;
+        if (!mc.loadFont(input_string))
+            return false;
+        missing.clear();
+        for (uint16_t i = mc.getChunkCount() - 1; i > 0; i--)
+            if (!mc.hasChunk(i))
+                missing.push_back(i);
+        while (!missing.empty()) {
+            chunks.clear();
+            for (size_t i = 0; i < missing.size(); i++) {
+                if (randtt() < 1250 || (i + 1 == missing.size() &&
+                                        chunks.empty())) {
+                    chunks.push_back(missing[i]);
+                    missing[i--] = missing.back();
+                    missing.pop_back();
+                }
+            }
+            for (auto ck: chunks) {
+                std::ifstream ifs(mc.getChunkURI(ck), std::ios::binary);
+                std::stringstream ss;
+                ss << ifs.rdbuf();
+                std::string s = ss.str();
+                if (!ifs || !mc.addChunk(ck, s, true)) {
+                    std::cerr << "Could not add chunk " << ck << std::endl;
+                    return false;
+                }
+            }
+            // The chunk data (with headers) bounds the glyph data added
+            if ((inPlace + moved) % 2 == 0 &&
+                !mc.reserveFontLength(mc.fontData.size() +
+                                      mc.merger.chunkBytes() + 16))
+                return false;
+            if (!mc.merge())
+                return false;
+            if (mc.lastMergeStats().inPlace)
+                inPlace++;
+            else
+                moved++;
+            iftb::sfnt sf(mc.getFontAsString());
+            if (!sf.read() || !sf.checkSums(true)) {
+                std::cerr << "Bad checksums after merging " << chunks.size()
+                          << " chunks" << std::endl;
+                return false;
+            }
+        }
+    }
+    std::cerr << "Checked checksums after " << inPlace << " merges in place"
+              << " and " << moved << " into a new buffer" << std::endl;
     return true;
 }
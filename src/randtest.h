@@ -11,7 +11,9 @@ it.
    features and calculates both the IFTB chunk set and the harfbuzz
    subsetter glyph closure for those parameters. It then verifies that
    the set of glyphs corresponding to those chunks is a superset of the
-   glyph closure. It is only included in the encoder.
+   glyph closure. Last it merges random sets of chunks, read from the
+   chunk files, and checks the table checksums after each merge. It is
+   only included in the encoder.
  */
  
 #include <string>
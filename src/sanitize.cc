@@ -17,7 +17,7 @@ it.
 
 bool iftb::sanitize(std::string &s, iftb::config &conf) {
     iftb::sfnt sfnt(s);
-    simplestream ss;
+    spanreader sr;
 
     if (!sfnt.read()) {
         return false;
@@ -25,14 +25,14 @@ bool iftb::sanitize(std::string &s, iftb::config &conf) {
 
     sfnt.checkSums(conf.verbosity() > 1);
 
-    if (!sfnt.getTableStream(ss, T_IFTB)) {
+    if (!sfnt.getTableReader(sr, T_IFTB)) {
         std::cerr << "Error: No IFTB table in font file" << std::endl;
         return false;
     }
 
     table_IFTB tiftb;
     
-    if (!tiftb.decompile(ss))
+    if (!tiftb.decompile(sr))
         return false;
 
     bool is_cff = false, is_variable = false;
@@ -59,14 +59,14 @@ bool iftb::sanitize(std::string &s, iftb::config &conf) {
     } else
         std::cerr << "Error: No CFF, CFF2 or glyf table in font." << std::endl;
 
-    if (!sfnt.getTableStream(ss, tag("head"))) {
+    if (!sfnt.getTableReader(sr, tag("head"))) {
         std::cerr << "Error: No head table in font file" << std::endl;
         return false;
     }
 
     if (!is_cff) {
-        ss.seekg(50);
-        int16_t i2lf = readObject<int16_t>(ss);
+        sr.seek(50);
+        int16_t i2lf = readObject<int16_t>(sr);
         if (i2lf != 1) {
             std::cerr << "Error: indexToLocFormat in head table != 1" << std::endl;
             return false;
@@ -78,20 +78,20 @@ bool iftb::sanitize(std::string &s, iftb::config &conf) {
 
 void iftb::info(std::string &s, iftb::config &conf) {
     iftb::sfnt sfnt(s);
-    simplestream ss;
+    spanreader sr;
 
     if (!sfnt.read()) {
         return;
     }
 
-    if (!sfnt.getTableStream(ss, T_IFTB)) {
+    if (!sfnt.getTableReader(sr, T_IFTB)) {
         std::cerr << "Error: No IFTB table in font file" << std::endl;
         return;
     }
 
     table_IFTB tiftb;
     
-    if (!tiftb.decompile(ss))
+    if (!tiftb.decompile(sr))
         return;
 
     if (conf.verbosity() > 2)
@@ -8,6 +8,7 @@ it.
 */
 
 #include <cassert>
+#include <algorithm>
 #include <stdexcept>
 #include <iostream>
 
@@ -28,6 +29,16 @@ bool iftb::sfnt::getTableStream(simplestream &s, uint32_t tg) {
     return true;
 }
 
+bool iftb::sfnt::getTableReader(spanreader &r, uint32_t tg) {
+    assert(Table::known_tables.find(tg) != Table::known_tables.end());
+    auto i = directory.find(tg);
+    if (i == directory.end() || i->second.offset > length ||
+        i->second.length > length - i->second.offset)
+        return false;
+    r = spanreader(buffer + i->second.offset, i->second.length);
+    return true;
+}
+
 uint32_t iftb::sfnt::getTableOffset(uint32_t tg, uint32_t &length) {
     assert(Table::known_tables.find(tg) != Table::known_tables.end());
     uint32_t r = 0;
@@ -42,9 +53,9 @@ uint32_t iftb::sfnt::getTableOffset(uint32_t tg, uint32_t &length) {
 }
 
 bool iftb::sfnt::read() {
+    spanreader r(buffer, length);
     /* Read and validate version */
-    ss.seekg(0);
-    readObject(ss, origTag);
+    readObject(r, origTag);
     switch (origTag) {
         case 0x00010000: /* 1.0 */
         // case TAG('t', 'r', 'u', 'e'):
@@ -58,13 +69,13 @@ bool iftb::sfnt::read() {
     }
     curTag = origTag;
 
-    readObject(ss, numTables);
+    readObject(r, numTables);
 
     // header checksum
-    ss.seekg(0);
+    r.seek(0);
     uint32_t nLongs = header_size / 4;
     while (nLongs--)
-        headerSum += readObject<uint32_t>(ss);
+        headerSum += readObject<uint32_t>(r);
 
     otherTableSum = otherRecordSum = 0;
 
@@ -72,11 +83,11 @@ bool iftb::sfnt::read() {
         uint32_t tg;
         Table table;
         table.entryNum = i;
-        table.entryOffset = ss.tellg();
-        readObject(ss, tg);
-        readObject(ss, table.checksum);
-        readObject(ss, table.offset);
-        readObject(ss, table.length);
+        table.entryOffset = r.tell();
+        readObject(r, tg);
+        readObject(r, table.checksum);
+        readObject(r, table.offset);
+        readObject(r, table.length);
         if (Table::known_tables.find(tg) != Table::known_tables.end())
             directory.emplace(tg, table);
         else {
@@ -85,7 +96,7 @@ bool iftb::sfnt::read() {
             otherTableSum += table.checksum;
         }
     }
-    if (ss.fail())
+    if (r.fail())
         return error("Stream read failure");
     return true;
 }
@@ -173,31 +184,81 @@ bool iftb::sfnt::recalcTableChecksum(uint32_t tg) {
     return true;
 }
 
+bool iftb::sfnt::recalcChecksums() {
+    for (auto &[tg, table]: directory)
+        if (!calcTableChecksum(table, table.checksum, tg == T_HEAD))
+            return false;
+    return true;
+}
+
+bool iftb::sfnt::adjustChecksum(uint32_t tg, uint32_t delta) {
+    assert(Table::known_tables.find(tg) != Table::known_tables.end());
+    auto t = directory.find(tg);
+    if (t == directory.end())
+        return error("Can't find sfnt table to adjust");
+
+    t->second.checksum += delta;
+    return true;
+}
+
 bool iftb::sfnt::calcTableChecksum(const Table &table, uint32_t &checksum,
                                    bool is_head) {
-    uint32_t headAdjustment, nLongs = (table.length + 3) / 4, p;
+    uint32_t headAdjustment;
+    uint64_t paddedLength = ((uint64_t) table.length + 3) / 4 * 4;
 
     if (sfntOnly)
         return error("Can't calculate table checksum with sfnt header only");
 
-    checksum = 0;
-    p = ss.tellg();
-    ss.seekg(table.offset);
-    while (nLongs--)
-        checksum += readObject<uint32_t>(ss);
+    if (table.offset > length || paddedLength > length - table.offset)
+        return error("Stream failure when calculating checksum");
+    checksum_lanes lanes;
+    lanes.add(buffer + table.offset, paddedLength);
+    checksum = lanes.at(0);
 
     if (is_head) {
         /* Adjust sum to ignore head.checkSumAdjustment field */
-        ss.seekg(table.offset + head_adjustment_offset);
-        readObject(ss, headAdjustment);
+        spanreader r(buffer, length);
+        r.seek(table.offset + head_adjustment_offset);
+        readObject(r, headAdjustment);
+        if (r.fail())
+            return error("Stream failure when calculating checksum");
         checksum -= headAdjustment;
     }
-    ss.seekg(p);
+    return true;
+}
 
-    if (ss.fail()) {
-        return error("Stream failure when calculating checksum");
+static inline uint64_t loadLE64(const uint8_t *p) {
+    return (uint64_t) p[0] | (uint64_t) p[1] << 8 | (uint64_t) p[2] << 16 |
+           (uint64_t) p[3] << 24 | (uint64_t) p[4] << 32 |
+           (uint64_t) p[5] << 40 | (uint64_t) p[6] << 48 |
+           (uint64_t) p[7] << 56;
+}
+
+/* Sums eight bytes per step by masking alternate bytes of a 64-bit word
+   into 16-bit fields, which hold the sums of up to 256 steps before they
+   are folded into the lanes. Faster than a word at a time through a
+   stream even where the compiler does not vectorize it.
+ */
+void iftb::checksum_lanes::add(const char *buf, uint32_t length) {
+    const uint8_t *p = (const uint8_t *) buf;
+    const uint64_t mask = 0x00FF00FF00FF00FFULL;
+    uint32_t i = 0;
+    while (length - i >= 8) {
+        uint32_t n = std::min((length - i) / 8, 256u);
+        uint64_t even = 0, odd = 0;
+        for (uint32_t j = 0; j < n; j++, i += 8) {
+            uint64_t w = loadLE64(p + i);
+            even += w & mask;
+            odd += (w >> 8) & mask;
+        }
+        // Fields 0 and 2 of even hold lane 0 and those of odd lane 1
+        s[0] += (uint32_t) (even & 0xFFFF) + (uint32_t) (even >> 32 & 0xFFFF);
+        s[1] += (uint32_t) (odd & 0xFFFF) + (uint32_t) (odd >> 32 & 0xFFFF);
+        s[2] += (uint32_t) (even >> 16 & 0xFFFF) + (uint32_t) (even >> 48);
+        s[3] += (uint32_t) (odd >> 16 & 0xFFFF) + (uint32_t) (odd >> 48);
     }
-    return true;
+    for (; i < length; i++)
+        s[i & 3] += p[i];
 }
 
 /* Check that the table checksums and the head adjustment checksums are
@@ -212,10 +273,10 @@ bool iftb::sfnt::checkSums(bool full) {
     bool good = true, hasCFF = false;
 
     /* Read directory header */
-    ss.seekg(0);
+    spanreader r(buffer, length);
     uint32_t nLongs = header_size / 4;
     while (nLongs--)
-        nHeaderSum += readObject<uint32_t>(ss);
+        nHeaderSum += readObject<uint32_t>(r);
 
     totalsum += nHeaderSum;
 
@@ -224,11 +285,11 @@ bool iftb::sfnt::checkSums(bool full) {
         uint32_t tg;
         Table table;
         table.entryNum = i;
-        table.entryOffset = ss.tellg();
-        readObject(ss, tg);
-        readObject(ss, table.checksum);
-        readObject(ss, table.offset);
-        readObject(ss, table.length);
+        table.entryOffset = r.tell();
+        readObject(r, tg);
+        readObject(r, table.checksum);
+        readObject(r, table.offset);
+        readObject(r, table.length);
         if (tg == T_CFF || tg == T_CFF2)
             hasCFF = true;
         totalsum += tg + 2 * table.checksum + table.offset + table.length;
@@ -275,8 +336,8 @@ bool iftb::sfnt::checkSums(bool full) {
         good = false;
         std::cerr << "Warning: No head table found" << std::endl;
     } else {
-        ss.seekg(headTableOffset + head_adjustment_offset);
-        readObject(ss, checkSumAdjustment);
+        r.seek(headTableOffset + head_adjustment_offset);
+        readObject(r, checkSumAdjustment);
     }
 
     if (good && checkSumAdjustment != 0xb1b0afba - totalsum) {
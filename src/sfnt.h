@@ -25,8 +25,25 @@ it.
 
 namespace iftb {
     class sfnt;
+    struct checksum_lanes;
 }
 
+/* The byte sums, by position mod 4, of a run of table data. A run's share
+   of a table checksum depends only on these and on where in the table the
+   run starts, so a run that moves can be re-summed without re-reading it.
+ */
+struct iftb::checksum_lanes {
+    uint32_t s[4] = {0, 0, 0, 0};
+    void add(const char *buf, uint32_t length);
+    // The run's contribution to a table checksum when it starts at pos
+    uint32_t at(uint32_t pos) const {
+        uint32_t r = 0;
+        for (uint32_t k = 0; k < 4; k++)
+            r += s[k] << 8 * (3 - ((pos + k) & 3));
+        return r;
+    }
+};
+
 class iftb::sfnt {
  public:
     struct Table {
@@ -47,14 +64,17 @@ class iftb::sfnt {
     };
     sfnt() {}
     sfnt(char *b, uint32_t l, bool so = false) :
-        sfntOnly(so), ss(b, l) { }
+        sfntOnly(so), buffer(b), length(l), ss(b, l) { }
     sfnt(std::string &s, bool so = false) :
-        sfntOnly(so), ss(s.data(), s.size()) { }
+        sfntOnly(so), buffer(s.data()), length(s.size()),
+        ss(s.data(), s.size()) { }
     void setBuffer(std::string &s, bool so = false) {
         setBuffer(s.data(), s.size(), so);
     }
     void setBuffer(char *b, uint32_t l, bool so = false) {
         sfntOnly = so;
+        buffer = b;
+        length = l;
         ss.rdbuf()->pubsetbuf(b, l);
     }
     bool read();
@@ -65,11 +85,16 @@ class iftb::sfnt {
         return directory.find(tg) != directory.end();
     }
     bool getTableStream(simplestream &s, uint32_t tg);
+    bool getTableReader(spanreader &r, uint32_t tg);
     uint32_t getTableOffset(uint32_t tg, uint32_t &length);
 
     bool adjustTable(uint32_t tag, uint32_t offset, uint32_t length,
                      bool rechecksum);
     bool recalcTableChecksum(uint32_t tg);
+    // Recalculates the checksum of every table in the directory
+    bool recalcChecksums();
+    // Adds a change computed by the caller to a table's checksum
+    bool adjustChecksum(uint32_t tg, uint32_t delta);
     bool calcTableChecksum(const Table &table, uint32_t &checksum,
                            bool is_head=false);
     bool checkSums(bool full=false);
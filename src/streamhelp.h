@@ -12,6 +12,8 @@ it.
  */
 
 #include <iostream>
+#include <cstring>
+#include <cassert>
 
 #pragma once
 
@@ -85,6 +87,132 @@ static void writeObject(std::ostream &f, const T& o) {
     }
 }
 
+/* 1, 2, and 4 byte big-endian output and raw copies into a buffer whose
+   size is known in advance, without a stream layer.
+ */
+struct spanwriter {
+    spanwriter(char *buf, size_t length) : buf(buf), length(length) {}
+    template<class T>
+    void write(const T &o) {
+        static_assert(sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4);
+        assert(pos + sizeof(T) <= length);
+        uint32_t v = (uint32_t) o;
+        for (int i = sizeof(T) - 1; i >= 0; i--)
+            buf[pos++] = (char) (v >> (i * 8) & 0xFF);
+    }
+    void write(const char *d, size_t l) {
+        assert(pos + l <= length);
+        if (l > 0)
+            memcpy(buf + pos, d, l);
+        pos += l;
+    }
+    size_t tell() const { return pos; }
+    void seek(size_t p) {
+        assert(p <= length);
+        pos = p;
+    }
+    bool full() const { return pos == length; }
+private:
+    char *buf;
+    size_t length, pos = 0;
+};
+
+template<class T>
+static void writeObject(spanwriter &w, const T& o) {
+    w.write(o);
+}
+
+/* 1, 2, and 4 byte big-endian input and arrays from a buffer, without a
+   stream layer. As with an istream, reading past the end sets fail() and
+   further reads return zero.
+ */
+struct spanreader {
+    spanreader(const char *buf=nullptr, size_t length=0) :
+        buf((const uint8_t *) buf), length(length) {}
+    template<class T>
+    void read(T &o) {
+        static_assert(sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4);
+        if (!check(sizeof(T))) {
+            o = (T) 0;
+            return;
+        }
+        o = (T) load<T>(buf + pos);
+        pos += sizeof(T);
+    }
+    template<class T>
+    T read() {
+        T r;
+        read(r);
+        return r;
+    }
+    void read(char *d, size_t l) {
+        if (!check(l))
+            return;
+        if (l > 0)
+            memcpy(d, buf + pos, l);
+        pos += l;
+    }
+    /* The byte loops are simple enough for compilers to turn into swap
+       or shuffle instructions */
+    template<class T>
+    void readArray(T *d, size_t n) {
+        if (!check(n * sizeof(T))) {
+            memset(d, 0, n * sizeof(T));
+            return;
+        }
+        const uint8_t *p = buf + pos;
+        for (size_t i = 0; i < n; i++, p += sizeof(T))
+            d[i] = (T) load<T>(p);
+        pos += n * sizeof(T);
+    }
+    const char *data() const { return (const char *) buf; }
+    size_t size() const { return length; }
+    size_t tell() const { return pos; }
+    void seek(size_t p) {
+        if (p > length) {
+            failed = true;
+            pos = length;
+        } else
+            pos = p;
+    }
+    void skip(size_t l) { seek(pos + l); }
+    bool fail() const { return failed; }
+private:
+    bool check(size_t l) {
+        if (failed || l > length - pos) {
+            failed = true;
+            pos = length;
+            return false;
+        }
+        return true;
+    }
+    template<class T>
+    static uint32_t load(const uint8_t *p) {
+        switch (sizeof(T)) {
+            case 1:
+                return p[0];
+            case 2:
+                return (uint32_t) p[0] << 8 | p[1];
+            default:
+                return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 |
+                       (uint32_t) p[2] << 8 | p[3];
+        }
+    }
+    const uint8_t *buf;
+    size_t length, pos = 0;
+    bool failed = false;
+};
+
+template<class T>
+static void readObject(spanreader &r, T& o) {
+    r.read(o);
+}
+
+template<class T>
+inline T readObject(spanreader &r) {
+    return r.read<T>();
+}
+
 struct simpleibuf : std::streambuf {
     simpleibuf(char *buf=nullptr, size_t length=0) {
         setg(buf, buf, buf + length);
@@ -10,193 +10,313 @@ it.
 #include "table_IFTB.h"
 
 #include <iomanip>
+#include <algorithm>
 #include <set>
 
 #include "tag.h"
 
+static uint32_t load24(const char *p) {
+    const uint8_t *u = (const uint8_t *) p;
+    return (uint32_t) u[0] << 16 | (uint32_t) u[1] << 8 | u[2];
+}
+
+static void append24(std::string &s, uint32_t v) {
+    s.push_back((char) (v >> 16 & 0xFF));
+    s.push_back((char) (v >> 8 & 0xFF));
+    s.push_back((char) (v & 0xFF));
+}
+
 void iftb::table_IFTB::writeChunkSet(std::ostream &os, bool seekTo) {
-    uint8_t u8 = 0;
-    uint32_t chunkBytes = (chunkCount + 7) / 8;
     if (seekTo)
-        os.seekp(50);
-    for (int i = 0; i < chunkCount; i++) {
-        if (i && i % 8 == 0) {
-            writeObject(os, u8);
-            chunkBytes--;
-            u8 = 0;
-        }
-        u8 |= (chunkSet[i] ? 1 : 0) << (i % 8);
-    }
-    if (chunkBytes) {
-        writeObject(os, u8);
-    }
+        os.seekp(headerLength());
+    chunkSet.write(os);
 }
 
 void iftb::table_IFTB::dumpChunkSet(std::ostream &os) {
     os << "chunkSet indexes: ";
     bool printed = false;
-    for (uint32_t i = 0; i < chunkCount; i++) {
-        if (chunkSet[i]) {
-            if (printed)
-                os << ", ";
-            printed = true;
-            os << i;
-        }
+    for (auto i: chunkSet) {
+        if (printed)
+            os << ", ";
+        printed = true;
+        os << i;
     }
     os << std::endl;
 }
 
+void iftb::table_IFTB::addCodepointRange(uint32_t start, uint32_t end,
+                                         uint16_t cidx) {
+    assert(start <= end && end <= 0x10FFFF);
+    assert(cidx < chunkCount);
+    assert(rangeCount == 0 ||
+           start > load24(codepointRanges.data() +
+                          (rangeCount - 1) * rangeRecordSize() + 3));
+    append24(codepointRanges, start);
+    append24(codepointRanges, end);
+    if (chunkCount > 256)
+        codepointRanges.push_back((char) (cidx >> 8));
+    codepointRanges.push_back((char) (cidx & 0xFF));
+    rangeCount++;
+}
+
 bool iftb::table_IFTB::getMissingChunks(const std::vector<uint32_t> &unicodes,
                                         const std::vector<uint32_t> &features,
-                                        std::set<uint16_t> &cks) {
-    cks.clear();
-    uint16_t ck;
+                                        iftb::chunk_set &cks) {
+    cks.resize(chunkCount);
+    cks.reset();
     for (auto cp: unicodes) {
-        auto i = uniMap.find(cp);
-        if (i == uniMap.end())
-            continue;
-        ck = i->second;
-        if (!chunkSet[ck])
-            cks.emplace(ck);
+        uint16_t ck = getMissingChunk(cp);
+        if (ck != 0)
+            cks.set(ck);
     }
+    addFeatureChunks(features, cks);
+    return true;
+}
+
+void iftb::table_IFTB::addFeatureChunks(const std::vector<uint32_t> &features,
+                                        iftb::chunk_set &cks) {
+    iftb::table_IFTB_view::feature_entry fe;
+    uint16_t ck;
     for (auto feat: features) {
-        auto i = featureMap.find(feat);
-        if (i == featureMap.end())
+        if (!view.findFeature(feat, fe))
             continue;
-        ck = i->second.startIndex - 1;
-        for (auto r: i->second.ranges) {
+        ck = fe.startIndex - 1;
+        for (uint16_t k = 0; k < fe.rangeCount; k++) {
+            auto r = view.getFeatureRange(fe, k);
             ck++;
-            assert(r.first <= r.second);
-            for (uint16_t j = r.first; j <= r.second; j++) {
-                if (chunkSet[j] || cks.find(j) != cks.end()) {
-                    cks.emplace(ck);
-                    break;
-                }
-            }
+            if (chunkSet[ck])
+                continue;
+            if (chunkSet.anyInRange(r.first, r.second) ||
+                cks.anyInRange(r.first, r.second))
+                cks.set(ck);
         }
     }
+}
+
+bool iftb::table_IFTB::rankMissingChunks(const std::vector<uint32_t> &unicodes,
+                                         const std::vector<float> &weights,
+                                         const std::vector<uint32_t> &features,
+                                         iftb::chunk_set &cks,
+                                         std::vector<uint16_t> &order) {
+    if (weights.size() != unicodes.size())
+        return error("Codepoint and weight counts differ");
+    if (!getMissingChunks(unicodes, features, cks))
+        return false;
+
+    std::vector<double> weight(chunkCount, 0.0);
+    iftb::chunk_set codepointChunks(chunkCount), featureChunks(chunkCount);
+    for (size_t i = 0; i < unicodes.size(); i++) {
+        uint16_t ck = getCodepointChunk(unicodes[i]);
+        if (cks[ck]) {
+            weight[ck] += weights[i];
+            codepointChunks.set(ck);
+        }
+    }
+    // Only missing chunks have weight, so the ranges sum those added now
+    iftb::table_IFTB_view::feature_entry fe;
+    for (auto feat: features) {
+        if (!view.findFeature(feat, fe))
+            continue;
+        for (uint16_t k = 0; k < fe.rangeCount; k++) {
+            uint16_t ck = fe.startIndex + k;
+            if (!cks[ck] || codepointChunks[ck])
+                continue;
+            featureChunks.set(ck);
+            auto r = view.getFeatureRange(fe, k);
+            for (uint32_t j = r.first; j <= r.second; j++)
+                weight[ck] += weight[j];
+        }
+    }
+
+    std::vector<std::pair<double, uint16_t>> ranked;
+    for (auto ck: cks)
+        ranked.emplace_back(weight[ck] / getChunkFetchBytes(ck), ck);
+    std::stable_sort(ranked.begin(), ranked.end(),
+                     [&featureChunks](const auto &a, const auto &b) {
+        if (featureChunks[a.second] != featureChunks[b.second])
+            return featureChunks[b.second];
+        return a.first > b.first;
+    });
+    order.clear();
+    for (auto &r: ranked)
+        order.push_back(r.second);
     return true;
 }
 
+uint32_t iftb::table_IFTB::getChunkFetchBytes(uint16_t cidx) {
+    auto r = view.getChunkRange(cidx);
+    if (r.second > r.first)
+        return r.second - r.first;
+    if (cidx >= 1 && cidx <= chunkSizes.size() && chunkSizes[cidx - 1].length)
+        return chunkSizes[cidx - 1].length;
+    return 1;
+}
+
 uint32_t iftb::table_IFTB::getChunkOffset(uint16_t cidx) {
-    if (cidx < 1 && cidx >= chunkOffsets.size() - 1)
-        return 0;
-    return chunkOffsets[cidx-1];
+    return view.getChunkOffset(cidx);
 }
 
 std::pair<uint32_t, uint32_t> iftb::table_IFTB::getChunkRange(uint16_t cidx) {
-    if (cidx < 1 && cidx >= chunkOffsets.size() - 1)
-        return std::pair<uint32_t, uint32_t>(0, 0);
-
-    return std::pair<uint32_t, uint32_t>(chunkOffsets[cidx-1],
-                                         chunkOffsets[cidx]);
+    return view.getChunkRange(cidx);
 }
 
             
-uint32_t iftb::table_IFTB::compile(std::ostream &os, uint32_t offset) {
+/* The subtable offsets and the total length are all known from the
+   counts and string lengths, so the table is sized and laid out first
+   and then written front to back into a single allocation.
+ */
+std::string iftb::table_IFTB::compile() {
     uint32_t gidMapTableOffset = 0, chunkOffsetTableOffset = 0;
-    uint32_t featureMapTableOffset = 0, relOffsetsOffset = 0;
-    os.seekp(offset);
-    writeObject(os, majorVersion);
-    writeObject(os, minorVersion);
-    writeObject(os, (uint32_t) 0);  // reserved
-    writeObject(os, id[0]);
-    writeObject(os, id[1]);
-    writeObject(os, id[2]);
-    writeObject(os, id[3]);
-    writeObject(os, flags);
-    writeObject(os, chunkCount);
-    writeObject(os, glyphCount);
-    writeObject(os, CFFCharStringsOffset);
-    relOffsetsOffset = (uint32_t) os.tellp();
-    writeObject(os, gidMapTableOffset);
-    writeObject(os, chunkOffsetTableOffset);
-    writeObject(os, featureMapTableOffset);
-    writeChunkSet(os);
+    uint32_t featureMapTableOffset = 0, dictionaryOffset = 0;
+    uint32_t chunkSizesOffset = 0, codepointRangesOffset = 0;
+    uint32_t idxSize = chunkCount > 256 ? 2 : 1, firstMappedGid, l;
+    // Decompiled tables keep their subtables in the view, not the vectors
+    assert(gidMap.size() == glyphCount);
+    if (rangeCount > 0)
+        minorVersion = 4;
+    else if (chunkSizes.size() > 0)
+        minorVersion = 3;
+    else if (dictionary.length > 0)
+        minorVersion = 2;
+    else
+        minorVersion = 1;
 
     assert(filesURI.length() < 257);
-    writeObject(os, (uint8_t) (filesURI.length() - 1));
-    os.write(filesURI.data(), filesURI.length());
     assert(rangeFileURI.length() < 257);
-    writeObject(os, (uint8_t) (rangeFileURI.length() - 1));
-    os.write(rangeFileURI.data(), rangeFileURI.length());
-
-    gidMapTableOffset = ((uint32_t) os.tellp()) - offset;
-    bool writing = false;
-    for (uint32_t i = 0; i < glyphCount; i++) {
-        if (!writing && gidMap[i] == 0)
-            continue;
-        else if (!writing) {
-            writeObject(os, (uint16_t) i);
-            writing = true;
-        }
-        writeChunkIndex(os, gidMap[i]);
-    }
+    l = headerLength() + (chunkCount + 7) / 8;
+    l += 1 + filesURI.length() + 1 + rangeFileURI.length();
+    gidMapTableOffset = l;
+    for (firstMappedGid = 0; firstMappedGid < glyphCount; firstMappedGid++)
+        if (gidMap[firstMappedGid] != 0)
+            break;
+    if (firstMappedGid < glyphCount)
+        l += 2 + (glyphCount - firstMappedGid) * idxSize;
     if (chunkOffsets.size() > 0) {
         assert(chunkOffsets.size() == chunkCount);
-        chunkOffsetTableOffset = ((uint32_t) os.tellp()) - offset;
-        for (auto i: chunkOffsets)
-            writeObject(os, i);
+        chunkOffsetTableOffset = l;
+        l += 4 * chunkOffsets.size();
     }
     if (featureMap.size() > 0) {
-        featureMapTableOffset = ((uint32_t) os.tellp()) - offset;
-        writeObject(os, (uint16_t)featureMap.size());
+        featureMapTableOffset = l;
+        l += 2 + featureMap.size() * (4 + 2 * idxSize);
+        for (auto &[t, fm]: featureMap)
+            l += fm.ranges.size() * 2 * idxSize;
+    }
+    if (dictionary.length > 0) {
+        dictionaryOffset = l;
+        l += 8 + dictionary.prefix.size();
+    }
+    if (chunkSizes.size() > 0) {
+        assert(chunkSizes.size() + 1 == chunkCount);
+        assert(chunkSizeTables == 1 || chunkSizeTables == 2);
+        chunkSizesOffset = l;
+        l += 1 + chunkSizes.size() * 4 * (1 + chunkSizeTables);
+    }
+    if (rangeCount > 0) {
+        assert(codepointRanges.size() == rangeCount * rangeRecordSize());
+        codepointRangesOffset = l;
+        l += 4 + codepointRanges.size();
+    }
+
+    std::string s(l, 0);
+    spanwriter w(s.data(), s.size());
+    writeObject(w, majorVersion);
+    writeObject(w, minorVersion);
+    writeObject(w, (uint32_t) 0);  // reserved
+    writeObject(w, id[0]);
+    writeObject(w, id[1]);
+    writeObject(w, id[2]);
+    writeObject(w, id[3]);
+    writeObject(w, flags);
+    writeObject(w, chunkCount);
+    writeObject(w, glyphCount);
+    writeObject(w, CFFCharStringsOffset);
+    writeObject(w, gidMapTableOffset);
+    writeObject(w, chunkOffsetTableOffset);
+    writeObject(w, featureMapTableOffset);
+    if (minorVersion > 1)
+        writeObject(w, dictionaryOffset);
+    if (minorVersion > 2)
+        writeObject(w, chunkSizesOffset);
+    if (minorVersion > 3)
+        writeObject(w, codepointRangesOffset);
+    chunkSet.write(w);
+
+    writeObject(w, (uint8_t) (filesURI.length() - 1));
+    w.write(filesURI.data(), filesURI.length());
+    writeObject(w, (uint8_t) (rangeFileURI.length() - 1));
+    w.write(rangeFileURI.data(), rangeFileURI.length());
+
+    assert(w.tell() == gidMapTableOffset);
+    if (firstMappedGid < glyphCount) {
+        writeObject(w, (uint16_t) firstMappedGid);
+        for (uint32_t i = firstMappedGid; i < glyphCount; i++)
+            writeChunkIndex(w, gidMap[i]);
+    }
+    for (auto i: chunkOffsets)
+        writeObject(w, i);
+    if (featureMap.size() > 0) {
+        assert(w.tell() == featureMapTableOffset);
+        writeObject(w, (uint16_t)featureMap.size());
         for (auto &[t, fm]: featureMap) {
             assert(fm.ranges.size() > 0);
-            writeObject(os, t);
-            writeChunkIndex(os, fm.startIndex);
-            writeChunkIndex(os, fm.ranges.size());
+            writeObject(w, t);
+            writeChunkIndex(w, fm.startIndex);
+            writeChunkIndex(w, fm.ranges.size());
         }
         for (auto &[t, fm]: featureMap) {
             for (auto &[start, end]: fm.ranges) {
-                writeChunkIndex(os, start);
-                writeChunkIndex(os, end);
+                writeChunkIndex(w, start);
+                writeChunkIndex(w, end);
             }
         }
     }
-    uint32_t l = ((uint32_t) os.tellp()) - offset;
-    os.seekp(offset + relOffsetsOffset);
-    writeObject(os, gidMapTableOffset);
-    writeObject(os, chunkOffsetTableOffset);
-    writeObject(os, featureMapTableOffset);
-    return l;
+    if (dictionary.length > 0) {
+        writeObject(w, dictionary.length);
+        writeObject(w, (uint32_t) dictionary.prefix.size());
+        w.write(dictionary.prefix.data(), dictionary.prefix.size());
+    }
+    if (chunkSizes.size() > 0) {
+        writeObject(w, chunkSizeTables);
+        for (auto &cs: chunkSizes) {
+            writeObject(w, cs.length);
+            for (int t = 0; t < chunkSizeTables; t++)
+                writeObject(w, cs.tableBytes[t]);
+        }
+    }
+    if (rangeCount > 0) {
+        writeObject(w, rangeCount);
+        w.write(codepointRanges.data(), codepointRanges.size());
+    }
+    assert(w.full());
+    return s;
 }
 
-bool iftb::table_IFTB::decompile(std::istream &is, uint32_t offset) {
-    uint32_t gidMapTableOffset, chunkOffsetTableOffset;
-    uint32_t featureMapTableOffset;
-    uint16_t firstMappedGid;
-    is.seekg(offset);
-    readObject(is, majorVersion);
-    if (majorVersion != 0)
-        return error("majorVersion != 0, will not read");
-    readObject(is, minorVersion);
-    if (minorVersion != 1)
-        return error("minorVersion != 1, will not read");
-    readObject<uint32_t>(is);  // reserved
-    readObject(is, id[0]);
-    readObject(is, id[1]);
-    readObject(is, id[2]);
-    readObject(is, id[3]);
-    readObject(is, flags);
-    readObject(is, chunkCount);
-    readObject(is, glyphCount);
-    readObject(is, CFFCharStringsOffset);
-    readObject(is, gidMapTableOffset);
-    readObject(is, chunkOffsetTableOffset);
-    readObject(is, featureMapTableOffset);
+/* The header is read and the subtables checked by the view. Only the
+   chunk set, URIs, dictionary and chunk sizes are copied out of the table.
+ */
+bool iftb::table_IFTB::decompile(spanreader &is, uint32_t offset) {
+    if (offset > is.size() ||
+        !view.validate(is.data() + offset, is.size() - offset))
+        return false;
+    majorVersion = view.majorVersion;
+    minorVersion = view.minorVersion;
+    flags = view.flags;
+    for (int i = 0; i < 4; i++)
+        id[i] = view.id[i];
+    CFFCharStringsOffset = view.CFFCharStringsOffset;
+    chunkCount = view.chunkCount;
+    glyphCount = view.glyphCount;
+    gidMap.clear();
+    chunkOffsets.clear();
+    featureMap.clear();
+    codepointRanges.clear();
+    rangeCount = 0;
+    is.seek(offset + headerLength());
     uint8_t u8;
 
     chunkSet.resize(chunkCount);
-    uint32_t chunkBytes = (chunkCount + 7) / 8;
-    for (uint32_t i=0; i < chunkBytes; i++) {
-        readObject(is, u8);
-        for (int j = 0; j < 8; j++) {
-            if (i * 8 + j >= chunkCount)
-                break;
-            chunkSet[i * 8 + j] = u8 & (1 << j);
-        }
-    }
+    chunkSet.read(is);
     readObject(is, u8);
     filesURI.resize(u8 + 1);
     is.read(filesURI.data(), u8 + 1);
@@ -206,43 +326,38 @@ bool iftb::table_IFTB::decompile(std::istream &is, uint32_t offset) {
     is.read(rangeFileURI.data(), u8 + 1);
     rangeFileURI[u8] = 0;  // To be safe
 
-    is.seekg(offset + gidMapTableOffset);
-    readObject(is, firstMappedGid);
-    for (uint32_t i = 0; i < glyphCount; i++) {
-        if (i < firstMappedGid)
-            gidMap.push_back(0);
-        else {
-            gidMap.push_back(readChunkIndex(is));
+    dictionary.length = 0;
+    dictionary.prefix.clear();
+    if (view.dictionaryOffset != 0) {
+        is.seek(offset + view.dictionaryOffset);
+        readObject(is, dictionary.length);
+        uint32_t prefixLength = readObject<uint32_t>(is);
+        if (prefixLength > (1 << 24)) {
+            view.rebind(nullptr);
+            return error("Chunk dictionary too large");
         }
+        dictionary.prefix.resize(prefixLength);
+        is.read(dictionary.prefix.data(), prefixLength);
     }
-    chunkOffsets.clear();
-    if (chunkOffsetTableOffset != 0) {
-        is.seekg(offset + chunkOffsetTableOffset);
-        for (int i = 0; i < chunkCount; i++)
-            chunkOffsets.push_back(readObject<uint32_t>(is));
-    }
-    featureMap.clear();
-    if (featureMapTableOffset != 0) {
-        is.seekg(offset + featureMapTableOffset);
-        uint16_t featureMapCount;
-        readObject(is, featureMapCount);
-        for (int i = 0; i < featureMapCount; i++) {
-            uint32_t feat;
-            FeatureMap fm;
-            readObject(is, feat);
-            fm.startIndex = readChunkIndex(is);
-            fm.ranges.resize(readChunkIndex(is));
-            featureMap.emplace(feat, std::move(fm));
+    chunkSizes.clear();
+    if (view.chunkSizesOffset != 0 && chunkCount > 1) {
+        is.seek(offset + view.chunkSizesOffset);
+        readObject(is, chunkSizeTables);
+        if (chunkSizeTables != 1 && chunkSizeTables != 2) {
+            view.rebind(nullptr);
+            return error("Chunk size table count must be 1 or 2");
         }
-        for (auto &[_, fm]: featureMap) {
-            for (auto &[start, end]: fm.ranges) {
-                start = readChunkIndex(is);
-                end = readChunkIndex(is);
-            }
+        chunkSizes.resize(chunkCount - 1);
+        for (auto &cs: chunkSizes) {
+            readObject(is, cs.length);
+            for (int t = 0; t < chunkSizeTables; t++)
+                readObject(is, cs.tableBytes[t]);
         }
     }
-    if (is.fail())
+    if (is.fail()) {
+        view.rebind(nullptr);
         return error("decompile stream read failure");
+    }
     return true;
 }
 
@@ -260,34 +375,60 @@ void iftb::table_IFTB::dump(std::ostream &os, bool full) {
     if (full) {
         os << "gidMap: ";
         bool printed = false;
-        for (uint32_t i = 0; i < gidMap.size(); i++) {
+        for (uint32_t i = 0; i < glyphCount; i++) {
             if (printed)
                 os << ", ";
             printed = true;
-            os << i << ":" << gidMap[i];
+            os << i << ":" << view.getGIDChunk(i);
         }
         os << std::endl;
     }
-    if (full && chunkOffsets.size() > 0) {
+    if (full && view.chunkOffsetTableOffset != 0) {
         os << "chunkOffsets: ";
         bool printed = false;
-        for (uint32_t i = 0; i < chunkOffsets.size(); i++) {
+        for (uint32_t i = 0; i < chunkCount; i++) {
             if (printed)
                 os << ", ";
             printed = true;
-            os << i << ":" << chunkOffsets[i];
+            os << i << ":" << view.load32(view.chunkOffsetTableOffset + 4 * i);
         }
         os << std::endl;
     }
-    if (featureMap.size() > 0) {
+    if (view.getFeatureCount() > 0) {
         os << "Separately mapped features: ";
         bool printed = false;
-        for (auto &[t, fm]: featureMap) {
+        for (uint16_t i = 0; i < view.getFeatureCount(); i++) {
             if (printed)
                 os << ", ";
             printed = true;
-            os << otag(t);
+            os << otag(view.getFeatureTag(i));
+        }
+        os << std::endl;
+    }
+    if (dictionary.length > 0) {
+        os << "Chunk dictionary: " << dictionary.length << " bytes (";
+        os << dictionary.prefix.size() << " compressed)" << std::endl;
+    }
+    if (chunkSizes.size() > 0) {
+        uint64_t total = 0, glyphBytes = 0;
+        for (auto &cs: chunkSizes) {
+            total += cs.length;
+            glyphBytes += cs.tableBytes[0] + cs.tableBytes[1];
+        }
+        os << "Uncompressed chunk total: " << total << " bytes (";
+        os << glyphBytes << " glyph data)" << std::endl;
+        if (full) {
+            os << "chunkSizes: ";
+            for (uint32_t i = 0; i < chunkSizes.size(); i++) {
+                if (i > 0)
+                    os << ", ";
+                os << i + 1 << ":" << chunkSizes[i].length;
+            }
+            os << std::endl;
         }
+    }
+    if (view.getCodepointRangeCount() > 0) {
+        os << "Codepoint ranges: " << view.getCodepointRangeCount();
         os << std::endl;
     }
     os << "filesURI: " << filesURI << std::endl;
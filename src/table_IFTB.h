@@ -9,8 +9,11 @@ it.
 
 /* The iftb::table_IFTB object has code to read, store, interact with,
    and (to a limited extent) update the contents of the IFTB table in
-   an IFTB-encoded font. (Only the chunk set can be updated.)  This code
-   is included in both the encoder and the client side.
+   an IFTB-encoded font. (Only the chunk set can be updated.)  The gid
+   map, chunk offsets, feature map and codepoint ranges of a decompiled
+   table are read in place through an iftb::table_IFTB_view, so the table
+   bytes must outlive it or be rebound. This code is included in both the
+   encoder and the client side.
  */
 
 #include <map>
@@ -23,14 +26,36 @@ it.
 
 #include "streamhelp.h"
 #include "cmap.h"
+#include "sfnt.h"
+#include "chunkset.h"
+#include "table_IFTB_view.h"
 
 #pragma once
 
 namespace iftb {
     class table_IFTB;
+    struct chunk_dictionary;
+    struct chunk_size;
     class chunker;
 }
 
+/* Chunks can be compressed as the continuation of a Brotli stream that
+   starts with dictionary data. prefix is that start of the stream, which
+   decompresses to length bytes.
+ */
+struct iftb::chunk_dictionary {
+    uint32_t length = 0;
+    std::string prefix;
+};
+
+/* The uncompressed length of a chunk and the bytes of glyph data it adds
+   to each of the (one or two) glyph tables.
+ */
+struct iftb::chunk_size {
+    uint32_t length = 0;
+    uint32_t tableBytes[2] = {0, 0};
+};
+
 class iftb::table_IFTB {
 public:
     table_IFTB() {
@@ -46,11 +71,9 @@ public:
     std::pair<uint32_t, uint32_t> getChunkRange(uint16_t cidx);
     std::string &getRangeFileURI() { return rangeFileURI; }
     const char * getChunkURI(uint16_t idx);
-    bool addcmap(std::istream &i, bool keepGIDMap = false) {
-        bool r = readcmap(i, uniMap, &gidMap);
-        if (r && !keepGIDMap)
-            gidMap.clear();
-        return r;
+    bool addcmap(spanreader &i) {
+        uniMap.clear();
+        return readcmap(i, uniMap, &view);
     }
     bool hasChunk(uint16_t cidx) {
         if (cidx >= chunkCount)
@@ -60,28 +83,62 @@ public:
         else
             return chunkSet[cidx];
     }
+    // True if chunks can be looked up without the cmap table
+    bool hasCodepointRanges() { return view.getCodepointRangeCount() > 0; }
+    uint16_t getGIDChunk(uint32_t gid) { return view.getGIDChunk(gid); }
+    // Follows the decompiled table bytes to a new buffer
+    void rebind(const char *buf) { view.rebind(buf); }
+    /* Appends a run of codepoints mapped to chunk cidx. Runs must be added
+       in codepoint order after the chunk count is set.
+     */
+    void addCodepointRange(uint32_t start, uint32_t end, uint16_t cidx);
+    uint16_t getCodepointChunk(uint32_t cp) {
+        if (view.getCodepointRangeCount() > 0)
+            return view.getCodepointChunk(cp);
+        return uniMap.get(cp);
+    }
     bool getMissingChunks(const std::vector<uint32_t> &unicodes,
                           const std::vector<uint32_t> &features,
-                          std::set<uint16_t> &cl);
+                          iftb::chunk_set &cl);
+    // The chunk for cp if it is not yet in the font, otherwise 0
+    uint16_t getMissingChunk(uint32_t cp) {
+        uint16_t ck = getCodepointChunk(cp);
+        return chunkSet[ck] ? 0 : ck;
+    }
+    /* Adds to cks (sized to the chunk count) the missing feature chunks
+       needed given the chunks in cks and those in the font
+     */
+    void addFeatureChunks(const std::vector<uint32_t> &features,
+                          iftb::chunk_set &cks);
+    /* As getMissingChunks, also ranking the missing chunks in order. The
+       chunks covering requested codepoints come first, by the total
+       weight of those codepoints (weights has one per codepoint) per
+       fetched byte. The feature chunks, which only matter after shaping,
+       follow by the weight of the chunks that add them per fetched byte.
+     */
+    bool rankMissingChunks(const std::vector<uint32_t> &unicodes,
+                           const std::vector<float> &weights,
+                           const std::vector<uint32_t> &features,
+                           iftb::chunk_set &cks, std::vector<uint16_t> &order);
+    /* The compressed length of a chunk in the range file, or failing that
+       its uncompressed length, or 1 if neither is known
+     */
+    uint32_t getChunkFetchBytes(uint16_t cidx);
     void dumpChunkSet(std::ostream &os);
     void writeChunkSet(std::ostream &os, bool seekTo = false);
+    // The chunk set's share of the checksum of the table at buf
+    uint32_t chunkSetChecksum(const char *buf) {
+        iftb::checksum_lanes lanes;
+        lanes.add(buf + headerLength(), (chunkCount + 7) / 8);
+        return lanes.at(headerLength());
+    }
     void setChunkCount(uint32_t cc) {
         chunkCount = cc;
-        chunkSet.clear();
         chunkSet.resize(chunkCount);
+        chunkSet.reset();
     }
-    uint16_t readChunkIndex(std::istream &i) {
-        uint8_t i8;
-        uint16_t i16;
-        if (chunkCount > 256) {
-            readObject(i, i16);
-            return i16;
-        } else {
-            readObject(i, i8);
-            return i8;
-        }
-    }
-    void writeChunkIndex(std::ostream &o, uint16_t idx) {
+    template<class W>
+    void writeChunkIndex(W &o, uint16_t idx) {
         uint8_t i8 = (uint8_t) idx;
         if (chunkCount > 256)
             writeObject(o, idx);
@@ -89,21 +146,27 @@ public:
             writeObject(o, i8);
     }
     uint32_t getGlyphCount() { return glyphCount; }
-    unsigned int compile(std::ostream &o, uint32_t offset = 0);
-    bool decompile(std::istream &i, uint32_t offset = 0);
+    std::string compile();
+    bool decompile(spanreader &i, uint32_t offset = 0);
     void dump(std::ostream &o, bool full = false);
     uint32_t getCharStringOffset() { return CFFCharStringsOffset; }
-    bool updateChunkSet(std::set<uint16_t> &chunks) {
-        for (auto idx: chunks) {
-            if (idx >= chunkCount)
-                return false;
-            if (chunkSet[idx])
-                return false;
-            chunkSet[idx] = true;
-        }
+    // Fails without changes if any of chunks is already in the chunk set
+    bool updateChunkSet(const iftb::chunk_set &chunks) {
+        if (chunks.size() != chunkCount || chunkSet.intersects(chunks))
+            return false;
+        chunkSet |= chunks;
         return true;
     }
     uint32_t *getID() { return id; }
+    const iftb::chunk_dictionary *getDictionary() {
+        return dictionary.length > 0 ? &dictionary : nullptr;
+    }
+    // Null if the table has no chunk sizes
+    const iftb::chunk_size *getChunkSize(uint16_t cidx) {
+        if (cidx < 1 || cidx > chunkSizes.size())
+            return nullptr;
+        return &chunkSizes[cidx - 1];
+    }
 private:
     struct FeatureMap {
         friend class iftb::chunker;
@@ -116,6 +179,12 @@ private:
         uint16_t startIndex = 0;
         std::vector<std::pair<uint16_t, uint16_t>> ranges;
     };
+    /* Version 0.2 adds the dictionary offset, 0.3 the chunk sizes offset
+       and 0.4 the codepoint ranges offset
+     */
+    uint32_t headerLength() { return 50 + 4 * (minorVersion - 1); }
+    // uint24 start and end codepoints and a chunk index
+    uint32_t rangeRecordSize() { return chunkCount > 256 ? 8 : 7; }
     bool error(const char *m) {
         std::cerr << "IFTB table error: " << m << std::endl;
         return false;
@@ -124,11 +193,20 @@ private:
     uint32_t id[4];
     uint32_t CFFCharStringsOffset {0};
     uint32_t chunkCount {0}, glyphCount {0};
-    std::vector<bool> chunkSet;
+    iftb::chunk_set chunkSet;
+    // Filled in by the encoder; a decompiled table reads these via view
     std::vector<uint16_t> gidMap;
     std::map<uint32_t, FeatureMap> featureMap;
     std::vector<uint32_t> chunkOffsets;
+    iftb::chunk_dictionary dictionary;
+    // Empty, or one entry for each chunk after the first
+    std::vector<iftb::chunk_size> chunkSizes;
+    uint8_t chunkSizeTables {1};
+    // The range records as written by compile()
+    std::string codepointRanges;
+    uint32_t rangeCount {0};
+    iftb::table_IFTB_view view;
     std::string filesURI, rangeFileURI;
     std::array<char, 257> fURIbuf;
-    std::unordered_map<uint32_t, uint16_t> uniMap;
+    iftb::unicode_map uniMap;
 };
@@ -0,0 +1,150 @@
+/*
+Copyright 2023 Adobe
+All Rights Reserved.
+
+NOTICE: Adobe permits you to use, modify, and distribute this file in
+accordance with the terms of the Adobe license agreement accompanying
+it.
+*/
+
+#include "table_IFTB_view.h"
+
+#include "streamhelp.h"
+
+bool iftb::table_IFTB_view::validate(const char *buf, uint32_t len) {
+    spanreader is(buf, len);
+    data = nullptr;
+    readObject(is, majorVersion);
+    if (majorVersion != 0)
+        return error("majorVersion != 0, will not read");
+    readObject(is, minorVersion);
+    if (minorVersion < 1 || minorVersion > 4)
+        return error("minorVersion not between 1 and 4, will not read");
+    readObject<uint32_t>(is);  // reserved
+    readObject(is, id[0]);
+    readObject(is, id[1]);
+    readObject(is, id[2]);
+    readObject(is, id[3]);
+    readObject(is, flags);
+    readObject(is, chunkCount);
+    readObject(is, glyphCount);
+    readObject(is, CFFCharStringsOffset);
+    readObject(is, gidMapTableOffset);
+    readObject(is, chunkOffsetTableOffset);
+    readObject(is, featureMapTableOffset);
+    dictionaryOffset = chunkSizesOffset = codepointRangesOffset = 0;
+    if (minorVersion > 1)
+        readObject(is, dictionaryOffset);
+    if (minorVersion > 2)
+        readObject(is, chunkSizesOffset);
+    if (minorVersion > 3)
+        readObject(is, codepointRangesOffset);
+    if (is.fail())
+        return error("Table too short for header");
+    // Chunk indexes are at most 16 bits
+    if (chunkCount > 0x10000)
+        return error("chunkCount too large");
+    idxSize = chunkCount > 256 ? 2 : 1;
+
+    data = (const uint8_t *) buf;
+    length = len;
+    if (!checkGIDMap() || !checkFeatureMap() || !checkCodepointRanges())
+        return false;
+    if (chunkOffsetTableOffset != 0 &&
+        !fits(chunkOffsetTableOffset, 4 * (uint64_t) chunkCount))
+        return error("Chunk offset table out of bounds");
+    return true;
+}
+
+bool iftb::table_IFTB_view::checkGIDMap() {
+    if (!fits(gidMapTableOffset, 2))
+        return error("gid map out of bounds");
+    firstMappedGid = load16(gidMapTableOffset);
+    if (firstMappedGid >= glyphCount)
+        return true;
+    uint32_t n = glyphCount - firstMappedGid;
+    if (!fits(gidMapTableOffset + 2, (uint64_t) n * idxSize))
+        return error("gid map out of bounds");
+    return true;
+}
+
+/* The feature records are followed by the chunk ranges of every
+   feature in record order.
+ */
+bool iftb::table_IFTB_view::checkFeatureMap() {
+    featureCount = 0;
+    if (featureMapTableOffset == 0)
+        return true;
+    if (!fits(featureMapTableOffset, 2))
+        return error("Feature map out of bounds");
+    uint16_t count = load16(featureMapTableOffset);
+    uint32_t o = featureMapTableOffset + 2;
+    if (!fits(o, (uint64_t) count * featureRecordSize()))
+        return error("Feature map out of bounds");
+    uint32_t ro = o + count * featureRecordSize();
+    for (uint16_t i = 0; i < count; i++, o += featureRecordSize()) {
+        uint16_t startIndex = readChunkIndex(o + 4);
+        uint16_t rangeCount = readChunkIndex(o + 4 + idxSize);
+        if ((uint32_t) startIndex + rangeCount > chunkCount)
+            return error("Feature map chunk index out of range");
+        if (!fits(ro, (uint64_t) rangeCount * 2 * idxSize))
+            return error("Feature map out of bounds");
+        for (uint16_t j = 0; j < rangeCount; j++, ro += 2 * idxSize) {
+            uint16_t start = readChunkIndex(ro);
+            uint16_t end = readChunkIndex(ro + idxSize);
+            if (start > end || end >= chunkCount)
+                return error("Feature map chunk range invalid");
+        }
+    }
+    featureCount = count;
+    return true;
+}
+
+bool iftb::table_IFTB_view::checkCodepointRanges() {
+    rangeCount = 0;
+    if (codepointRangesOffset == 0)
+        return true;
+    if (!fits(codepointRangesOffset, 4))
+        return error("Codepoint ranges out of bounds");
+    uint32_t count = load32(codepointRangesOffset);
+    uint64_t size = (uint64_t) count * rangeRecordSize();
+    if (!fits(codepointRangesOffset + 4, size))
+        return error("Codepoint ranges out of bounds");
+    rangeCount = count;
+    return true;
+}
+
+bool iftb::table_IFTB_view::findFeature(uint32_t tag, feature_entry &fe) {
+    uint32_t o = featureMapTableOffset + 2;
+    fe.rangesOffset = o + featureCount * featureRecordSize();
+    for (uint16_t i = 0; i < featureCount; i++, o += featureRecordSize()) {
+        fe.tag = load32(o);
+        fe.startIndex = readChunkIndex(o + 4);
+        fe.rangeCount = readChunkIndex(o + 4 + idxSize);
+        if (fe.tag == tag)
+            return true;
+        fe.rangesOffset += fe.rangeCount * 2 * idxSize;
+    }
+    return false;
+}
+
+/* Finds the last range starting at or before cp. Ranges that are not
+   sorted give wrong answers but no reads outside the table.
+ */
+uint16_t iftb::table_IFTB_view::getCodepointChunk(uint32_t cp) {
+    uint32_t rs = rangeRecordSize(), lo = 0, hi = rangeCount;
+    uint32_t base = codepointRangesOffset + 4;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (load24(base + mid * rs) <= cp)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == 0)
+        return 0;
+    uint32_t o = base + (lo - 1) * rs;
+    if (cp > load24(o + 3))
+        return 0;
+    return checkedIndex(readChunkIndex(o + 6));
+}
@@ -0,0 +1,126 @@
+/*
+Copyright 2023 Adobe
+All Rights Reserved.
+
+NOTICE: Adobe permits you to use, modify, and distribute this file in
+accordance with the terms of the Adobe license agreement accompanying
+it.
+*/
+
+/* The iftb::table_IFTB_view object reads the header of an IFTB table and
+   answers gid map, chunk offset, feature map and codepoint range lookups
+   directly from the table bytes, which it does not copy or own. This code
+   is included in both the encoder and the client side.
+ */
+
+#include <iostream>
+#include <utility>
+#include <cstdint>
+
+#pragma once
+
+namespace iftb {
+    class table_IFTB_view;
+    class table_IFTB;
+}
+
+class iftb::table_IFTB_view {
+ public:
+    friend class iftb::table_IFTB;
+    /* A separately mapped feature has rangeCount chunks from startIndex,
+       each needed when any chunk in the matching range is present.
+     */
+    struct feature_entry {
+        uint32_t tag = 0;
+        uint16_t startIndex = 0, rangeCount = 0;
+        uint32_t rangesOffset = 0;
+    };
+    /* Checks the header and that the subtables read through the view are
+       within the table, so the lookups need no bounds checks of their own.
+       Only the (small) feature map is checked entry by entry; out of range
+       chunk indexes in the gid map and codepoint ranges read as 0. buf must
+       stay valid until the view is rebound.
+     */
+    bool validate(const char *buf, uint32_t length);
+    // Points the view at a moved copy of the validated bytes
+    void rebind(const char *buf) { data = (const uint8_t *) buf; }
+    bool valid() { return data != nullptr; }
+    uint32_t getGlyphCount() { return glyphCount; }
+    uint16_t getGIDChunk(uint32_t gid) {
+        if (gid < firstMappedGid || gid >= glyphCount)
+            return 0;
+        return checkedIndex(readChunkIndex(gidMapTableOffset + 2 +
+                                           (gid - firstMappedGid) * idxSize));
+    }
+    // Returns 0 for indexes without an offset
+    uint32_t getChunkOffset(uint16_t cidx) {
+        if (chunkOffsetTableOffset == 0 || cidx < 1 || cidx >= chunkCount)
+            return 0;
+        return load32(chunkOffsetTableOffset + 4 * (cidx - 1));
+    }
+    std::pair<uint32_t, uint32_t> getChunkRange(uint16_t cidx) {
+        if (chunkOffsetTableOffset == 0 || cidx < 1 || cidx >= chunkCount)
+            return std::pair<uint32_t, uint32_t>(0, 0);
+        uint32_t o = chunkOffsetTableOffset + 4 * (cidx - 1);
+        return std::pair<uint32_t, uint32_t>(load32(o), load32(o + 4));
+    }
+    uint16_t getFeatureCount() { return featureCount; }
+    uint32_t getFeatureTag(uint16_t i) {
+        return load32(featureMapTableOffset + 2 + i * featureRecordSize());
+    }
+    bool findFeature(uint32_t tag, feature_entry &fe);
+    std::pair<uint16_t, uint16_t> getFeatureRange(const feature_entry &fe,
+                                                  uint16_t i) {
+        uint32_t o = fe.rangesOffset + 2 * i * idxSize;
+        return std::pair<uint16_t, uint16_t>(readChunkIndex(o),
+                                             readChunkIndex(o + idxSize));
+    }
+    uint32_t getCodepointRangeCount() { return rangeCount; }
+    // Binary searches the codepoint ranges, returning 0 if cp is in none
+    uint16_t getCodepointChunk(uint32_t cp);
+ private:
+    uint32_t featureRecordSize() { return 4 + 2 * idxSize; }
+    // uint24 start and end codepoints and a chunk index
+    uint32_t rangeRecordSize() { return 6 + idxSize; }
+    uint16_t load16(uint32_t o) {
+        return (uint16_t) (data[o] << 8 | data[o + 1]);
+    }
+    uint32_t load24(uint32_t o) {
+        const uint8_t *p = data + o;
+        return (uint32_t) p[0] << 16 | (uint32_t) p[1] << 8 | p[2];
+    }
+    uint32_t load32(uint32_t o) {
+        const uint8_t *p = data + o;
+        return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 |
+               (uint32_t) p[2] << 8 | p[3];
+    }
+    uint16_t readChunkIndex(uint32_t o) {
+        return idxSize == 2 ? load16(o) : data[o];
+    }
+    uint16_t checkedIndex(uint16_t cidx) {
+        return cidx < chunkCount ? cidx : 0;
+    }
+    bool fits(uint32_t offset, uint64_t size) {
+        return offset <= length && size <= length - offset;
+    }
+    bool checkGIDMap();
+    bool checkFeatureMap();
+    bool checkCodepointRanges();
+    bool error(const char *m) {
+        std::cerr << "IFTB table error: " << m << std::endl;
+        data = nullptr;
+        return false;
+    }
+    const uint8_t *data {nullptr};
+    uint32_t length {0};
+    uint16_t majorVersion {0}, minorVersion {1}, flags {0};
+    uint32_t id[4];
+    uint32_t CFFCharStringsOffset {0};
+    uint32_t chunkCount {0}, glyphCount {0}, idxSize {1};
+    uint32_t gidMapTableOffset {0}, chunkOffsetTableOffset {0};
+    uint32_t featureMapTableOffset {0}, dictionaryOffset {0};
+    uint32_t chunkSizesOffset {0}, codepointRangesOffset {0};
+    uint32_t firstMappedGid {0};
+    uint16_t featureCount {0};
+    uint32_t rangeCount {0};
+};
@@ -53,11 +53,41 @@ uint32_t *iftb_reserve_feature_list(void *v, uint32_t length) {
     return cl->setFeaturesLen(length);
 }
 
+float *iftb_reserve_weight_list(void *v, uint32_t length) {
+    iftb::wasm_wrapper *cl = static_cast<iftb::wasm_wrapper *>(v);
+    return cl->setWeightsLen(length);
+}
+
 int iftb_compute_pending(void *v) {
     iftb::wasm_wrapper *cl = static_cast<iftb::wasm_wrapper *>(v);
     return cl->setPendingList() ? 1 : 0;
 }
 
+uint8_t *iftb_reserve_text(void *v, uint32_t length) {
+    iftb::wasm_wrapper *cl = static_cast<iftb::wasm_wrapper *>(v);
+    return cl->setTextLen(length);
+}
+
+int iftb_compute_pending_text(void *v, uint32_t length, int utf16) {
+    iftb::wasm_wrapper *cl = static_cast<iftb::wasm_wrapper *>(v);
+    return cl->setPendingText(length, utf16);
+}
+
+void iftb_set_incremental_pending(void *v, int incremental) {
+    iftb::wasm_wrapper *cl = static_cast<iftb::wasm_wrapper *>(v);
+    cl->setIncrementalPending(incremental);
+}
+
+void iftb_reset_seen(void *v) {
+    iftb::wasm_wrapper *cl = static_cast<iftb::wasm_wrapper *>(v);
+    cl->resetSeen();
+}
+
+uint32_t iftb_get_seen_codepoint_count(void *v) {
+    iftb::wasm_wrapper *cl = static_cast<iftb::wasm_wrapper *>(v);
+    return cl->getSeenCodepointCount();
+}
+
 uint16_t iftb_get_pending_list_count(void *v) {
     iftb::wasm_wrapper *cl = static_cast<iftb::wasm_wrapper *>(v);
     return cl->getPendingChunkListSize();
@@ -68,6 +98,12 @@ uint16_t *iftb_get_pending_list_location(void *v) {
     return cl->getPendingChunkListLoc();
 }
 
+// Returns the reserved font length, or 0 if the chunk sizes are unknown
+uint32_t iftb_reserve_pending_merge(void *v) {
+    iftb::wasm_wrapper *cl = static_cast<iftb::wasm_wrapper *>(v);
+    return cl->reservePendingMerge();
+}
+
 const char *iftb_range_file_uri(void *v) {
     iftb::wasm_wrapper *cl = static_cast<iftb::wasm_wrapper *>(v);
     return cl->getRangeFileURI();
@@ -98,6 +134,26 @@ int iftb_use_chunk_data(void *v, uint16_t cidx, int forcePending) {
     return cl->addChunkFromBuffer(cidx, forcePending) ? 1 : 0;
 }
 
+int iftb_begin_chunk(void *v, uint16_t cidx, int forcePending) {
+    iftb::wasm_wrapper *cl = static_cast<iftb::wasm_wrapper *>(v);
+    return cl->beginChunk(cidx, forcePending);
+}
+
+uint8_t *iftb_reserve_stream_data(void *v, uint32_t length) {
+    iftb::wasm_wrapper *cl = static_cast<iftb::wasm_wrapper *>(v);
+    return (uint8_t *) cl->allocateStreamBuffer(length);
+}
+
+int iftb_use_stream_data(void *v, uint16_t cidx, uint32_t length) {
+    iftb::wasm_wrapper *cl = static_cast<iftb::wasm_wrapper *>(v);
+    return cl->addStreamData(cidx, length) ? 1 : 0;
+}
+
+int iftb_end_chunk(void *v, uint16_t cidx) {
+    iftb::wasm_wrapper *cl = static_cast<iftb::wasm_wrapper *>(v);
+    return cl->endChunk(cidx) ? 1 : 0;
+}
+
 int iftb_can_merge(void *v) {
     iftb::wasm_wrapper *cl = static_cast<iftb::wasm_wrapper *>(v);
     return cl->canMerge() ? 1 : 0;
@@ -108,6 +164,26 @@ int iftb_merge(void *v, int as_iftb) {
     return cl->merge(as_iftb) ? 1 : 0;
 }
 
+void iftb_set_progressive_merge(void *v, int progressive) {
+    iftb::wasm_wrapper *cl = static_cast<iftb::wasm_wrapper *>(v);
+    cl->setProgressiveMerge(progressive != 0);
+}
+
+void iftb_set_merge_budget(void *v, uint32_t bytes, uint32_t millis) {
+    iftb::wasm_wrapper *cl = static_cast<iftb::wasm_wrapper *>(v);
+    cl->setMergeBudget(bytes, millis);
+}
+
+void iftb_set_deferred_checksums(void *v, int defer) {
+    iftb::wasm_wrapper *cl = static_cast<iftb::wasm_wrapper *>(v);
+    cl->setDeferredChecksums(defer != 0);
+}
+
+int iftb_finish_checksums(void *v) {
+    iftb::wasm_wrapper *cl = static_cast<iftb::wasm_wrapper *>(v);
+    return cl->finishChecksums() ? 1 : 0;
+}
+
 uint32_t iftb_get_font_length(void *v) {
     iftb::wasm_wrapper *cl = static_cast<iftb::wasm_wrapper *>(v);
     return cl->getFontLength();
@@ -63,7 +63,36 @@ class iftb::wasm_wrapper {
             features.resize(length);
         return features.data();
     }
-    int setPendingList() { return cl.setPending(unicodes, features) ? 1 : 0; }
+    // Room for text of up to length bytes, as UTF-8 or UTF-16
+    uint8_t *setTextLen(uint32_t length) {
+        text.resize((length + 1) / 2);
+        return (uint8_t *) text.data();
+    }
+    int setPendingText(uint32_t length, int utf16) {
+        if (length > text.size() * 2) {
+            error("Text exceeds reserved length");
+            return 0;
+        }
+        if (utf16)
+            return cl.setPendingText(text.data(), length / 2, features) ? 1 : 0;
+        return cl.setPendingText((const char *) text.data(), length,
+                                 features) ? 1 : 0;
+    }
+    // Weights are used when there is one for each codepoint
+    float *setWeightsLen(uint32_t length) {
+        weights.clear();
+        if (length > 0)
+            weights.resize(length);
+        return weights.data();
+    }
+    int setPendingList() {
+        if (weights.size() > 0 && weights.size() == unicodes.size())
+            return cl.setPending(unicodes, features, weights) ? 1 : 0;
+        return cl.setPending(unicodes, features) ? 1 : 0;
+    }
+    void setIncrementalPending(bool i) { cl.setIncrementalPending(i); }
+    void resetSeen() { cl.resetSeen(); }
+    uint32_t getSeenCodepointCount() { return cl.getSeenCodepoints().size(); }
     uint16_t getPendingChunkListSize() {
         if (!cl.getPendingChunkList(pendingChunkList))
             return 0;
@@ -72,6 +101,13 @@ class iftb::wasm_wrapper {
     uint16_t *getPendingChunkListLoc() {
         return pendingChunkList.data();
     }
+    uint32_t reservePendingMerge() {
+        uint32_t fontLength;
+        size_t chunkBytes;
+        if (!cl.getPendingSizes(fontLength, chunkBytes) || !cl.reservePending())
+            return 0;
+        return fontLength;
+    }
     const char *getRangeFileURI() { return cl.getRangeFileURI().data(); }
     const char *getChunkURI(uint16_t cidx) { return cl.getChunkURI(cidx); }
     uint32_t getChunkOffset(uint16_t cidx) { return cl.getChunkOffset(cidx); }
@@ -85,12 +121,43 @@ class iftb::wasm_wrapper {
             buffers.erase(buffers.find(cidx));
         return r;
     }
-    bool canMerge() { return cl.canMerge(); }
+    // Returns 2 without beginning the chunk if it is already in the font
+    int beginChunk(uint16_t cidx, int setPending) {
+        if (cidx == 0) {
+            error("Attempt to add chunk 0");
+            return 0;
+        } else if (cidx < getChunkCount() && cl.hasChunk(cidx)) {
+            return 2;
+        }
+        return cl.beginChunk(cidx, setPending) ? 1 : 0;
+    }
+    // One staging buffer is reused for each block of streamed chunk data
+    char *allocateStreamBuffer(uint32_t length) {
+        if (streamBuffer.size() < length)
+            streamBuffer.resize(length);
+        return streamBuffer.data();
+    }
+    bool addStreamData(uint16_t cidx, uint32_t length) {
+        if (length > streamBuffer.size())
+            return error("Stream data exceeds reserved length");
+        return cl.addChunkData(cidx, streamBuffer.data(), length);
+    }
+    bool endChunk(uint16_t cidx) { return cl.endChunk(cidx); }
+    // With progressive merging, whether a merge of the arrivals is due
+    bool canMerge() {
+        return cl.progressiveMerge ? cl.mergeDue() : cl.canMerge();
+    }
+    void setProgressiveMerge(bool p) { cl.setProgressiveMerge(p); }
+    void setMergeBudget(uint32_t bytes, uint32_t millis) {
+        cl.setMergeBudget(bytes, millis);
+    }
     bool merge(bool asIFTB = true) { return cl.merge(asIFTB); }
-    uint32_t getFontLength() { return cl.fontData.size(); }
+    void setDeferredChecksums(bool d) { cl.setDeferredChecksums(d); }
+    bool finishChecksums() { return cl.finishChecksums(); }
+    uint32_t getFontLength() { return cl.getFontAsString().size(); }
     const uint8_t *getFontLoc(bool asIFTB = true) {
         cl.setType(asIFTB);
-        return (uint8_t *) cl.fontData.data();
+        return (uint8_t *) cl.getFontAsString().data();
     }
     bool error(const char *m) {
         std::cerr << "IFTB WASM wrapper Error: " << m << std::endl;
@@ -99,7 +166,11 @@ class iftb::wasm_wrapper {
     }
  private:
     std::unordered_map<uint16_t, std::string> buffers;
+    std::string streamBuffer;
     std::vector<uint32_t> unicodes, features;
+    std::vector<float> weights;
+    // uint16_t elements keep UTF-16 text aligned
+    std::vector<uint16_t> text;
     std::vector<uint16_t> pendingChunkList;
     iftb::client cl;
 };
@@ -115,17 +186,32 @@ extern int iftb_has_failed(void *v);
 extern uint16_t iftb_get_chunk_count(void *v);
 extern uint32_t *iftb_reserve_unicode_list(void *v, uint32_t length);
 extern uint32_t *iftb_reserve_feature_list(void *v, uint32_t length);
+extern float *iftb_reserve_weight_list(void *v, uint32_t length);
 extern int iftb_compute_pending(void *v);
+extern uint8_t *iftb_reserve_text(void *v, uint32_t length);
+extern int iftb_compute_pending_text(void *v, uint32_t length, int utf16);
+extern void iftb_set_incremental_pending(void *v, int incremental);
+extern void iftb_reset_seen(void *v);
+extern uint32_t iftb_get_seen_codepoint_count(void *v);
 extern uint16_t iftb_get_pending_list_count(void *v);
 extern uint16_t *iftb_get_pending_list_location(void *v);
+extern uint32_t iftb_reserve_pending_merge(void *v);
 extern const char *iftb_range_file_uri(void *v);
 extern const char *iftb_chunk_file_uri(void *v, uint16_t cidx);
 extern uint32_t iftb_get_chunk_offset(void *v, uint16_t cidx);
 extern uint8_t *iftb_reserve_chunk_data(void *v, uint16_t cidx,
                                         uint32_t length);
 extern int iftb_use_chunk_data(void *v, uint16_t cidx, int forcePending);
+extern int iftb_begin_chunk(void *v, uint16_t cidx, int forcePending);
+extern uint8_t *iftb_reserve_stream_data(void *v, uint32_t length);
+extern int iftb_use_stream_data(void *v, uint16_t cidx, uint32_t length);
+extern int iftb_end_chunk(void *v, uint16_t cidx);
 extern int iftb_can_merge(void *v);
 extern int iftb_merge(void *v, int as_iftb);
+extern void iftb_set_progressive_merge(void *v, int progressive);
+extern void iftb_set_merge_budget(void *v, uint32_t bytes, uint32_t millis);
+extern void iftb_set_deferred_checksums(void *v, int defer);
+extern int iftb_finish_checksums(void *v);
 extern uint32_t iftb_get_font_length(void *v);
 extern const uint8_t *iftb_get_font_location(void *v, int as_iftb);
 
@@ -157,6 +157,18 @@ struct iftb::wr_subset_input {
     hb_set_t *unicode_set() { return hb_subset_input_unicode_set(i); }
     hb_set_t *gid_set() { return hb_subset_input_glyph_set(i); }
     hb_set_t *set(hb_subset_sets_t st) { return hb_subset_input_set(i, st); }
+    // Copy the flags and sets of another input into this one
+    void copy(wr_subset_input &o) {
+        static const hb_subset_sets_t sets[] = {
+            HB_SUBSET_SETS_GLYPH_INDEX, HB_SUBSET_SETS_UNICODE,
+            HB_SUBSET_SETS_NO_SUBSET_TABLE_TAG,
+            HB_SUBSET_SETS_DROP_TABLE_TAG, HB_SUBSET_SETS_NAME_ID,
+            HB_SUBSET_SETS_NAME_LANG_ID, HB_SUBSET_SETS_LAYOUT_FEATURE_TAG
+        };
+        set_flags(o.get_flags());
+        for (auto st: sets)
+            hb_set_set(set(st), o.set(st));
+    }
     wr_face subset(wr_face &f) {
         hb_face_t *r = hb_subset_or_fail(f.f, i);
         return wr_face(r);